@@ -5,6 +5,10 @@
 
 #pragma once
 
+#include <memory>
+#include <ostream>
+#include <vector>
+
 #include "nes_memory.h"
 #include "nes_mapper.h"
 #include "nes_component.h"
@@ -82,6 +86,23 @@ struct nes_cpu_context
     unsigned char P;        // Status register - used by ALU unit
 };
 
+// Execution and cycle (CPU cycles) count for one profiled instruction, PC, or PRG bank
+struct nes_cpu_profile_counter
+{
+    uint64_t count;
+    uint64_t cycles;
+};
+
+#define PROFILE_PRG_BANK_COUNT 0x100    // 8KB banks - up to 2MB of PRG ROM
+
+// Flat counters filled in by the CPU when profiling is on - see nes_cpu::enable_profiler
+struct nes_cpu_profile
+{
+    nes_cpu_profile_counter op_codes[0x100];
+    nes_cpu_profile_counter pcs[RAM_SIZE];
+    nes_cpu_profile_counter prg_banks[PROFILE_PRG_BANK_COUNT];     // only code running from $8000~$ffff
+};
+
 enum nes_op_code
 {
     ORA_base = 0x00,
@@ -117,11 +138,13 @@ public :
     void stop_at_infinite_loop() { _stop_at_infinite_loop = true; }
     void stop_at_addr(uint16_t addr) { _is_stop_at_addr = true;  _stop_at_addr = addr; }
 
-    void set_carry_flag(bool set) { set_flag(PROCESSOR_STATUS_CARRY_MASK, set); }
-    uint8_t get_carry() { return (_context.P & PROCESSOR_STATUS_CARRY_MASK); }
+    // N/Z/C/V live outside of P so that updating them isn't a read-modify-write on P every time
+    // P is only materialized when somebody reads it - see P()
+    void set_carry_flag(bool set) { _carry = set; }
+    uint8_t get_carry() { return _carry; }
 
-    void set_zero_flag(bool set) { set_flag(PROCESSOR_STATUS_ZERO_MASK, set); }
-    bool is_zero() { return _context.P & PROCESSOR_STATUS_ZERO_MASK; }
+    void set_zero_flag(bool set) { _zero_result = set ? 0 : 1; }
+    bool is_zero() { return _zero_result == 0; }
 
     void set_interrupt_flag(bool set) { set_flag(PROCESSOR_STATUS_INTERRUPT_MASK, set); }
     bool is_interrupt() { return _context.P & PROCESSOR_STATUS_INTERRUPT_MASK; }
@@ -131,11 +154,11 @@ public :
     void set_I_flag(bool set) { set_flag(PROCESSOR_STATUS_I_MASK, set); }
     void set_B_flag(bool set) { set_flag(PROCESSOR_STATUS_B_MASK, set); }
 
-    void set_overflow_flag(bool set) { set_flag(PROCESSOR_STATUS_OVERFLOW_MASK, set); }
-    bool is_overflow() { return _context.P & PROCESSOR_STATUS_OVERFLOW_MASK; }
+    void set_overflow_flag(bool set) { _overflow = set; }
+    bool is_overflow() { return _overflow; }
 
-    void set_negative_flag(bool set) { set_flag(PROCESSOR_STATUS_NEGATIVE_MASK, set); }
-    bool is_negative() { return _context.P & PROCESSOR_STATUS_NEGATIVE_MASK; }
+    void set_negative_flag(bool set) { _negative_result = set ? PROCESSOR_STATUS_NEGATIVE_MASK : 0; }
+    bool is_negative() { return _negative_result & PROCESSOR_STATUS_NEGATIVE_MASK; }
 
     uint8_t peek(uint16_t addr) { return _mem->get_byte(addr); }
     uint16_t peek_word(uint16_t addr) { return _mem->get_word(addr); }
@@ -145,10 +168,46 @@ public :
     uint8_t &X() { return _context.X; }
     uint8_t &Y() { return _context.Y; }
     uint16_t &PC() { return _context.PC; }
-    uint8_t &P() { return _context.P; }
+    uint8_t P()
+    {
+        return (_context.P & ~(PROCESSOR_STATUS_CARRY_MASK | PROCESSOR_STATUS_ZERO_MASK | PROCESSOR_STATUS_OVERFLOW_MASK | PROCESSOR_STATUS_NEGATIVE_MASK)) |
+            (_carry ? PROCESSOR_STATUS_CARRY_MASK : 0) |
+            (_zero_result == 0 ? PROCESSOR_STATUS_ZERO_MASK : 0) |
+            (_overflow ? PROCESSOR_STATUS_OVERFLOW_MASK : 0) |
+            (_negative_result & PROCESSOR_STATUS_NEGATIVE_MASK);
+    }
+
+    void set_P(uint8_t val)
+    {
+        _context.P = val;
+        _carry = val & PROCESSOR_STATUS_CARRY_MASK;
+        set_zero_flag(val & PROCESSOR_STATUS_ZERO_MASK);
+        _overflow = val & PROCESSOR_STATUS_OVERFLOW_MASK;
+        _negative_result = val & PROCESSOR_STATUS_NEGATIVE_MASK;
+    }
     uint8_t &S() { return _context.S; }
 
+    nes_cycle_t cycle() { return _cycle; }
+
+    //
+    // Profiling - count executions and cycles of guest code per op code / PC / PRG bank
+    // Profiling runs the same core as tracing, so idle loops show up as they are instead of being skipped
+    //
+    void enable_profiler(bool enable);
+    void reset_profiler();
+    const nes_cpu_profile *profile() { return _profile.get(); }
+
+    // Write the hottest top_count op codes / PCs / PRG banks, sorted by cycles
+    void dump_profile(ostream &os, size_t top_count = 32);
+
     void request_nmi() { _nmi_pending = true; };
+
+    // IRQ is level triggered - it keeps interrupting (unless masked) until whoever asserted it releases it
+    void set_irq_line(bool asserted) { _irq_line = asserted; }
+    bool irq_line() { return _irq_line; }
+
+    // Stop the current run_to at cycle at the latest - used when a PPU event turns up earlier than expected
+    void shorten_run_to(nes_cycle_t cycle) { _run_to_cycle = min(_run_to_cycle, cycle); }
     void request_dma(uint16_t addr) { _dma_pending = true; _dma_addr = addr; }
 
 public :
@@ -189,18 +248,83 @@ public :
     }
 
 private :
+    typedef void (nes_cpu::*nes_op_handler)();
+
+    // One entry per op code - the handler is already specialized for its addressing mode
+    struct nes_op_entry
+    {
+        nes_op_handler handler;
+        const char *name;
+        nes_addr_mode addr_mode;
+        bool is_official;
+    };
+
+    // The 256-entry dispatch table - generated from the same op code table as cycles and lengths
+    // See NES_OP_CODE_TABLE in nes_cpu.cpp
+    static const nes_op_entry s_op_table[0x100];
+
+    // Pre-decoded instruction in PRG ROM - one table per 8KB bank, indexed by offset in the bank
+    // PRG ROM never changes, so a bank switch only changes which tables are looked up and switching back to a
+    // bank finds its instructions still decoded. Code in RAM (including $8000~$ffff without a mapper) isn't cached
+    struct nes_decoded_op
+    {
+        uint16_t operand;                   // the two bytes after the op code
+        uint8_t op_code;
+        bool decoded;
+    };
+
+    typedef unique_ptr<nes_decoded_op[]> nes_decoded_bank;
+
+    void map_decoded_banks();
+
+    uint8_t decode_op();
+
+    // Snapshot taken at the head of a loop, when jumping backwards
+    struct nes_idle_loop
+    {
+        uint16_t head;
+        nes_cpu_context context;
+        nes_cycle_t cycle;
+        uint32_t side_effect_count;
+        uint32_t status_read_count;
+    };
+
+    void detect_idle_loop();
+
+private :
+    // execute instructions until reaching count - instrumented (tracing / profiling) and plain cores are
+    // separate instantiations
+    template<bool instrumented> void run_to(nes_cycle_t count);
+
     // execute on instruction, update processor status as needed, and move CPU internal cycle count
-    void exec_one_instruction();
+    template<bool instrumented> void exec_one_instruction();
+
+    void profile_op(uint16_t pc, nes_cycle_t start_cycle);
     void NMI();
+    void IRQ();
     void OAMDMA();
 
     uint8_t decode_byte()
     {
+        if (_operand_prefetched)
+        {
+            uint8_t val = uint8_t(_operand);
+            _operand >>= 8;
+            _context.PC++;
+            return val;
+        }
+
         return _mem->get_byte(_context.PC++);
     }
 
     uint16_t decode_word()
     {
+        if (_operand_prefetched)
+        {
+            _context.PC += 2;
+            return _operand;
+        }
+
         auto word = _mem->get_word(_context.PC);
         _context.PC += 2;
         return word;
@@ -232,14 +356,18 @@ private :
     void step_cpu(nes_cpu_cycle_t cycle);
     void step_cpu(int64_t cycle);
 
-    nes_cpu_cycle_t get_cpu_cycle(operand_t operand, nes_addr_mode mode);
+    // Cycles of the current instruction - page crossing penalty only applies to op codes that have one
+    nes_cpu_cycle_t get_cpu_cycle();
+    nes_cpu_cycle_t get_cpu_cycle(operand_t operand);
     nes_cpu_cycle_t get_branch_cycle(bool cond, uint16_t new_addr, int8_t rel);
-    nes_cpu_cycle_t get_shift_cycle(nes_addr_mode addr_mode);
 
     //
     // Implements all address mode
+    // Every instruction handler is instantiated per addressing mode so all the addr_mode checks below
+    // are resolved at compile time
     //
-    operand_t decode_operand(nes_addr_mode addr_mode)
+    template<nes_addr_mode addr_mode>
+    operand_t decode_operand()
     {
         if (addr_mode == nes_addr_mode::nes_addr_mode_acc)
         {
@@ -253,7 +381,7 @@ private :
         else
         {
             bool page_crossing;
-            uint16_t addr = decode_operand_addr(addr_mode, &page_crossing);
+            uint16_t addr = decode_operand_addr<addr_mode>(&page_crossing);
             return { addr, operand_kind_addr, page_crossing };
         }
     }
@@ -290,7 +418,8 @@ private :
         }
     }
 
-    uint16_t decode_operand_addr(nes_addr_mode addr_mode, bool *page_crossing = nullptr)
+    template<nes_addr_mode addr_mode>
+    uint16_t decode_operand_addr(bool *page_crossing = nullptr)
     {
         if (page_crossing)
             *page_crossing = false;
@@ -380,8 +509,9 @@ private :
 
     void calc_alu_flag(uint8_t value)
     {
-        set_zero_flag(value == 0);
-        set_negative_flag(value & 0x80);
+        // Z and N are derived from the result when needed
+        _zero_result = value;
+        _negative_result = value;
     }
 
     bool is_sign_overflow(uint8_t val1, int8_t val2, uint8_t new_value)
@@ -390,215 +520,234 @@ private :
             ((val1 & 0x80) != (new_value & 0x80)));
     }
 
-    string get_op_str(const char *op, nes_addr_mode addr_mode, bool is_official = true);
+    string get_op_str();
     void append_operand_str(string &str, nes_addr_mode addr_mode);
 
     void branch(bool cond, nes_addr_mode addr_mode);
 
     // ADC - Add with carry
-    void ADC(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void ADC();
     void _ADC(uint8_t val);
 
     // AND - Logical AND
-    void AND(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void AND();
 
     // ASL - Arithmetic Shift Left
-    void ASL(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void ASL();
 
     // BCC - Branch if Carry Clear
-    void BCC(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void BCC();
 
     // BCS - Branch if Carry Set
-    void BCS(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void BCS();
 
     // BEQ - Branch if Equal
-    void BEQ(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void BEQ();
 
     // BIT - Bit test
-    void BIT(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void BIT();
 
     // BMI - Branch if minus
-    void BMI(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void BMI();
 
     // BNE - Branch if not equal
-    void BNE(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void BNE();
 
     // BPL - Branch if positive
-    void BPL(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void BPL();
 
     // BRK - Force interrupt
-    void BRK(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void BRK();
 
     // BVC - Branch if overflow clear
-    void BVC(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void BVC();
 
     // BVS - Branch if overflow set
-    void BVS(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void BVS();
 
     // CLC - Clear carry flag
-    void CLC(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void CLC();
 
     // CLD - Clear decimal mode
-    void CLD(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void CLD();
 
     // CLI - Clear interrupt disable
-    void CLI(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void CLI();
 
     // CLV - Clear overflow flag
-    void CLV(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void CLV();
 
     // CMP - Compare
-    void CMP(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void CMP();
 
     // CPX - Compare X register
-    void CPX(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void CPX();
 
     // CPY - Compare Y register
-    void CPY(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void CPY();
 
     // DEC - Decrement memory
-    void DEC(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void DEC();
 
     // DEX - Decrement X register
-    void DEX(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void DEX();
 
     // DEY - Decrement Y register
-    void DEY(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void DEY();
 
     // Exclusive OR
-    void EOR(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void EOR();
 
     // INC - Increment memory
-    void INC(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void INC();
 
     // INX - Increment X
-    void INX(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void INX();
 
     // INY - Increment Y
-    void INY(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void INY();
 
     // JMP - Jump
-    void JMP(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void JMP();
 
     // JSR - Jump to subroutine
-    void JSR(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void JSR();
 
     // LDA - Load Accumulator
-    void LDA(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void LDA();
 
     // LDX - Load X register
-    void LDX(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void LDX();
 
     // LDY - Load Y register
-    void LDY(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void LDY();
 
     // LSR - Logical shift right
-    void LSR(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void LSR();
 
     // NOP - NOP
-    void NOP(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void NOP();
 
     // ORA - Logical Inclusive OR
-    void ORA(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void ORA();
 
     // PHA - Push accumulator
-    void PHA(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void PHA();
 
     // PHP - Push processor status
-    void PHP(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void PHP();
 
     // PLA - Pull accumulator
-    void PLA(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void PLA();
 
     // PLP - Pull processor status
-    void PLP(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void PLP();
     void _PLP();
 
     // ROL - Rotate left
-    void ROL(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void ROL();
 
     // ROR - Rotate right
-    void ROR(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void ROR();
 
     // RTI - Return from interrupt
-    void RTI(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void RTI();
 
     // RTS - Return from subroutine
-    void RTS(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void RTS();
 
     // SBC - Subtract with carry
-    void SBC(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void SBC();
     void _SBC(uint8_t val);
 
     // SEC - Set carry flag
-    void SEC(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void SEC();
 
     // SED - Set decimal flag
-    void SED(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void SED();
 
     // SEI - Set interrupt disable
-    void SEI(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void SEI();
 
     // STA - Store Accumulator
-    void STA(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void STA();
 
     // STX - Store X
-    void STX(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void STX();
 
     // STY- Store Y
-    void STY(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void STY();
 
     // TAX - Transfer accumulator to X
-    void TAX(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void TAX();
 
     // TAY - Transfer accumulator to Y
-    void TAY(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void TAY();
 
     // TSX - Transfer stack pointer to X
-    void TSX(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void TSX();
 
     // TXA - Transfer X to acc
-    void TXA(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void TXA();
 
     // TXS - Transfer X to stack pointer
-    void TXS(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void TXS();
 
     // TYA - Transfer Y to accumulator
-    void TYA(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void TYA();
 
     // KIL - Kill?
-    void KIL(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void KIL();
+
+    // Unrecognized or illegal instruction
+    template<nes_addr_mode addr_mode> void ILL();
 
     //===================================================================================
     // Unofficial OP codes
     //===================================================================================
 
-    void ALR(nes_addr_mode addr_mode);
-    void ANC(nes_addr_mode addr_mode);
-    void ARR(nes_addr_mode addr_mode);
-    void AXS(nes_addr_mode addr_mode);
-    void LAX(nes_addr_mode addr_mode);
-    void SAX(nes_addr_mode addr_mode);
-    void DCP(nes_addr_mode addr_mode);
-    void ISC(nes_addr_mode addr_mode);
-    void RLA(nes_addr_mode addr_mode);
-    void RRA(nes_addr_mode addr_mode);
-    void SLO(nes_addr_mode addr_mode);
-    void SRE(nes_addr_mode addr_mode);
-
-    void XAA(nes_addr_mode addr_mode);
-    void AHX(nes_addr_mode addr_mode);
-    void TAS(nes_addr_mode addr_mode);
-    void LAS(nes_addr_mode addr_mode);
+    template<nes_addr_mode addr_mode> void ALR();
+    template<nes_addr_mode addr_mode> void ANC();
+    template<nes_addr_mode addr_mode> void ARR();
+    template<nes_addr_mode addr_mode> void AXS();
+    template<nes_addr_mode addr_mode> void LAX();
+    template<nes_addr_mode addr_mode> void SAX();
+    template<nes_addr_mode addr_mode> void DCP();
+    template<nes_addr_mode addr_mode> void ISC();
+    template<nes_addr_mode addr_mode> void RLA();
+    template<nes_addr_mode addr_mode> void RRA();
+    template<nes_addr_mode addr_mode> void SLO();
+    template<nes_addr_mode addr_mode> void SRE();
+
+    template<nes_addr_mode addr_mode> void XAA();
+    template<nes_addr_mode addr_mode> void AHX();
+    template<nes_addr_mode addr_mode> void TAS();
+    template<nes_addr_mode addr_mode> void LAS();
 
 private :
     nes_system      *_system;
     nes_memory      *_mem;
     nes_ppu         *_ppu;
-    nes_cpu_context _context;
+    nes_cpu_context _context;               // N/Z/C/V bits in _context.P are stale - use P()
+    uint8_t         _zero_result;           // Z = (_zero_result == 0)
+    uint8_t         _negative_result;       // N = bit 7 of _negative_result
+    bool            _carry;                 // C
+    bool            _overflow;              // V
+    uint8_t         _op_code;               // op code of current instruction
+    vector<nes_decoded_bank> _decoded_banks;    // indexed by PRG bank - allocated when code first runs from it
+    nes_decoded_op  *_decoded_slots[PRG_BANK_SLOT_COUNT];  // table of the bank in each slot of $8000~$ffff
+    uint32_t        _decoded_prg_generation;        // nes_memory::prg_generation _decoded_slots are for
+    uint32_t        _decoded_prg_rom_generation;    // nes_memory::prg_rom_generation _decoded_banks are for
+    uint16_t        _operand;               // operand bytes of current instruction from _decoded_banks
+    bool            _operand_prefetched;    // whether _operand is valid for current instruction
+    nes_cycle_t     _run_to_cycle;          // the cycle run_to is asked to run to
+    bool            _detect_idle_loop;      // skip idle loops - off when instrumented so that every instruction shows up
+    unique_ptr<nes_cpu_profile> _profile;   // null unless profiling
+    nes_idle_loop   _idle_loop;             // last loop iteration seen
     nes_cycle_t     _cycle;
     bool            _nmi_pending;           // NMI interrupt pending from PPU vertical blanking
     bool            _dma_pending;           // OAMDMA is requested from writing $4014
+    bool            _irq_line;              // IRQ asserted by mapper
     uint16_t        _dma_addr;              // starting address
     bool            _stop_at_infinite_loop; // stop at when the ROM starts infinite loop - useful for testing
     bool            _is_stop_at_addr;       // stop at a certain address - useful for testing
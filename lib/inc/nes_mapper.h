@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
 
 #include <memory>
@@ -48,16 +49,22 @@ class nes_mapper
 public :
     //
     // Called when mapper is loaded into memory
-    // Useful when all you need is a one-time memcpy
+    // Useful for mapping the initial banks
     //
     virtual void on_load_ram(nes_memory &mem) {}
 
     //
     // Called when mapper is loaded into PPU
-    // Useful when all you need is a one-time memcpy
+    // Useful for mapping the initial banks
     //
     virtual void on_load_ppu(nes_ppu &ppu) {}
 
+    //
+    // Called when mapper is loaded into system
+    // Useful for mappers that raise IRQ
+    //
+    virtual void on_load_cpu(nes_cpu &cpu) {}
+
     //
     // Returns various mapper related information
     //
@@ -69,49 +76,140 @@ public :
     //
     virtual void write_reg(uint16_t addr, uint8_t val) {};
 
+    //
+    // Scanline counter clocked by PPU A12 rising edges - mappers that have one hide these with their own and
+    // set has_a12_counter. PPU calls them through the concrete type - see nes_ppu::load_mapper
+    //
+    static const bool has_a12_counter = false;
+
+    // PPU A12 went from low to high
+    void on_a12_rise() {}
+
+    // How many A12 rises from now until the next IRQ - -1 if there won't be one
+    int a12_rises_until_irq() { return -1; }
+
     virtual ~nes_mapper() {}
 };
 
 //
-// iNES Mapper 0
-// http://wiki.nesdev.com/w/index.php/NROM
+// Common part of mappers that switch banks in fixed size windows - see nes_bank_mapper
 //
-class nes_mapper_nrom : public nes_mapper
+class nes_bank_mapper_base : public nes_mapper
 {
 public :
-    nes_mapper_nrom(
-        uint8_t *prg_rom, std::size_t prg_rom_size,
-        uint8_t *chr_rom, std::size_t chr_rom_size,
+    nes_bank_mapper_base(
+        const uint8_t *prg_rom, std::size_t prg_rom_size,
+        const uint8_t *chr_rom, std::size_t chr_rom_size,
         bool vertical_mirroring)
-        : _prg_rom(prg_rom), _prg_rom_size(prg_rom_size),
+        : _ppu(nullptr), _mem(nullptr), _prg_rom(prg_rom), _prg_rom_size(prg_rom_size),
           _chr_rom(chr_rom), _chr_rom_size(chr_rom_size), _vertical_mirroring(vertical_mirroring)
     {}
 
-    virtual void on_load_ram(nes_memory &mem);
-    virtual void on_load_ppu(nes_ppu &ppu);
-    virtual void get_info(nes_mapper_info &info);
+protected :
+    // Point size bytes at addr ($8000~$ffff) to offset in PRG ROM
+    void map_prg(uint16_t addr, std::size_t offset, std::size_t size);
 
-private :
-    uint8_t *_prg_rom;
+    // Point size bytes at PPU addr ($0000~$1fff) to offset in CHR ROM
+    void map_chr(uint16_t addr, std::size_t offset, std::size_t size);
+
+    // Bank number wraps around just like the unused high address lines - negative counts from the last bank
+    static std::size_t wrap_bank(int bank, std::size_t bank_count)
+    {
+        assert(bank_count > 0);
+
+        if (bank < 0)
+            bank += int(bank_count);
+
+        // ROM sizes are almost always power of 2
+        if ((bank_count & (bank_count - 1)) == 0)
+            return std::size_t(bank) & (bank_count - 1);
+
+        return std::size_t(bank) % bank_count;
+    }
+
+    static constexpr int log2(std::size_t size) { return size > 1 ? 1 + log2(size / 2) : 0; }
+
+protected :
+    nes_ppu *_ppu;
+    nes_memory *_mem;
+
+    const uint8_t *_prg_rom;
     std::size_t _prg_rom_size;
-    uint8_t *_chr_rom;
+    const uint8_t *_chr_rom;
     std::size_t _chr_rom_size;
     bool _vertical_mirroring;
 };
 
+//
+// Mapper that switches PRG ROM ($8000~$ffff) in prg_window_count windows of prg_window_size bytes, and CHR ROM
+// (PPU $0000~$1fff) in chr_window_count windows of chr_window_size bytes
+// The geometry is fixed at compile time so that window / bank numbers turn into addresses with constant shifts
+//
+template <std::size_t prg_window_size, std::size_t prg_window_count,
+          std::size_t chr_window_size, std::size_t chr_window_count>
+class nes_bank_mapper : public nes_bank_mapper_base
+{
+public :
+    using nes_bank_mapper_base::nes_bank_mapper_base;
+
+    static_assert(prg_window_size * prg_window_count == 0x8000, "PRG windows need to cover $8000~$ffff");
+    static_assert(chr_window_size * chr_window_count == 0x2000, "CHR windows need to cover PPU $0000~$1fff");
+
+    // nes_memory maps PRG ROM in 8KB banks and nes_ppu maps CHR in 1KB pages
+    static_assert((prg_window_size & (prg_window_size - 1)) == 0 && prg_window_size >= 0x2000, "bad PRG window size");
+    static_assert((chr_window_size & (chr_window_size - 1)) == 0 && chr_window_size >= 0x400, "bad CHR window size");
+
+protected :
+    static const int PRG_WINDOW_SHIFT = log2(prg_window_size);
+    static const int CHR_WINDOW_SHIFT = log2(chr_window_size);
+
+    // Map PRG ROM bank (in prg_window_size) into window - see wrap_bank for bank
+    void set_prg_window(int window, int bank)
+    {
+        assert(window >= 0 && window < int(prg_window_count));
+        std::size_t offset = wrap_bank(bank, _prg_rom_size >> PRG_WINDOW_SHIFT) << PRG_WINDOW_SHIFT;
+        map_prg(uint16_t(0x8000 + (window << PRG_WINDOW_SHIFT)), offset, prg_window_size);
+    }
+
+    // Map CHR ROM bank (in chr_window_size) into window - see wrap_bank for bank
+    // No CHR ROM means the PPU keeps using its CHR RAM
+    void set_chr_window(int window, int bank)
+    {
+        assert(window >= 0 && window < int(chr_window_count));
+        if (_chr_rom_size == 0)
+            return;
+
+        std::size_t offset = wrap_bank(bank, _chr_rom_size >> CHR_WINDOW_SHIFT) << CHR_WINDOW_SHIFT;
+        map_chr(uint16_t(window << CHR_WINDOW_SHIFT), offset, chr_window_size);
+    }
+};
+
+//
+// iNES Mapper 0
+// http://wiki.nesdev.com/w/index.php/NROM
+//
+class nes_mapper_nrom final : public nes_bank_mapper<0x4000, 2, 0x2000, 1>
+{
+public :
+    using nes_bank_mapper::nes_bank_mapper;
+
+    virtual void on_load_ram(nes_memory &mem);
+    virtual void on_load_ppu(nes_ppu &ppu);
+    virtual void get_info(nes_mapper_info &info);
+};
+
 //
 // iNES Mapper 1
 // http://wiki.nesdev.com/w/index.php/MMC1
 //
-class nes_mapper_mmc1 : public nes_mapper
+class nes_mapper_mmc1 final : public nes_bank_mapper<0x4000, 2, 0x1000, 2>
 {
 public :
     nes_mapper_mmc1(
-        uint8_t *prg_rom, std::size_t prg_rom_size,
-        uint8_t *chr_rom, std::size_t chr_rom_size,
+        const uint8_t *prg_rom, std::size_t prg_rom_size,
+        const uint8_t *chr_rom, std::size_t chr_rom_size,
         bool vertical_mirroring)
-        : _prg_rom(prg_rom), _prg_rom_size(prg_rom_size),
-          _chr_rom(chr_rom), _chr_rom_size(chr_rom_size), _vertical_mirroring(vertical_mirroring)
+        : nes_bank_mapper(prg_rom, prg_rom_size, chr_rom, chr_rom_size, vertical_mirroring)
     {
         _bit_latch = 0;
     }
@@ -129,67 +227,115 @@ public :
     void write_prg_bank(uint8_t val);
 
 private :
-    nes_ppu *_ppu;
-    nes_memory *_mem;
-
-    uint8_t *_prg_rom;
-    std::size_t _prg_rom_size;
-    uint8_t *_chr_rom;
-    std::size_t _chr_rom_size;
-    bool _vertical_mirroring;
-
-
     uint8_t _bit_latch;                         // for serial port
     uint8_t _reg;                               // current register being written
     uint8_t _control;                           // control register
 };
 
+//
+// iNES Mapper 2
+// http://wiki.nesdev.com/w/index.php/UxROM
+//
+class nes_mapper_uxrom final : public nes_bank_mapper<0x4000, 2, 0x2000, 1>
+{
+public :
+    using nes_bank_mapper::nes_bank_mapper;
+
+    virtual void on_load_ram(nes_memory &mem);
+    virtual void on_load_ppu(nes_ppu &ppu);
+    virtual void get_info(nes_mapper_info &info);
+
+    virtual void write_reg(uint16_t addr, uint8_t val);
+};
+
+//
+// iNES Mapper 3
+// http://wiki.nesdev.com/w/index.php/CNROM
+//
+class nes_mapper_cnrom final : public nes_bank_mapper<0x4000, 2, 0x2000, 1>
+{
+public :
+    using nes_bank_mapper::nes_bank_mapper;
+
+    virtual void on_load_ram(nes_memory &mem);
+    virtual void on_load_ppu(nes_ppu &ppu);
+    virtual void get_info(nes_mapper_info &info);
+
+    virtual void write_reg(uint16_t addr, uint8_t val);
+};
+
 //
 // iNES Mapper 4
 // http://wiki.nesdev.com/w/index.php/MMC3
 //
-class nes_mapper_mmc3 : public nes_mapper
+class nes_mapper_mmc3 final : public nes_bank_mapper<0x2000, 4, 0x400, 8>
 {
 public:
     nes_mapper_mmc3(
-        uint8_t *prg_rom, std::size_t prg_rom_size,
-        uint8_t *chr_rom, std::size_t chr_rom_size,
+        const uint8_t *prg_rom, std::size_t prg_rom_size,
+        const uint8_t *chr_rom, std::size_t chr_rom_size,
         bool vertical_mirroring)
-        : _prg_rom(prg_rom), _prg_rom_size(prg_rom_size),
-          _chr_rom(chr_rom), _chr_rom_size(chr_rom_size), _vertical_mirroring(vertical_mirroring)
+        : nes_bank_mapper(prg_rom, prg_rom_size, chr_rom, chr_rom_size, vertical_mirroring)
     {
-        // 1 -> neither 0 or 0x40 - means not yet initialized (and always will be different)
-        _prev_prg_mode = 1;
-
         _bank_select = 0;
+        for (auto &bank : _banks)
+            bank = 0;
+
+        _irq_latch = 0;
+        _irq_counter = 0;
+        _irq_reload = false;
+        _irq_enabled = false;
     }
 
     virtual void on_load_ram(nes_memory &mem);
     virtual void on_load_ppu(nes_ppu &ppu);
+    virtual void on_load_cpu(nes_cpu &cpu);
     virtual void get_info(nes_mapper_info &info);
 
     virtual void write_reg(uint16_t addr, uint8_t val);
 
+    static const bool has_a12_counter = true;
+    void on_a12_rise();
+    int a12_rises_until_irq();
+
 private:
     void write_bank_select(uint8_t val);
     void write_bank_data(uint8_t val);
     void write_mirroring(uint8_t val);
-    void write_prg_ram_protect(uint8_t val) { assert(false); }
-    void write_irq_latch(uint8_t val) { assert(false); }
-    void write_irq_reload(uint8_t val) { assert(false); }
-    void write_irq_disable(uint8_t val) { }
-    void write_irq_enable(uint8_t val) { assert(false); }
+    void write_prg_ram_protect(uint8_t val) { }    // PRG RAM at $6000~$7FFF is always enabled and writable
+    void write_irq_latch(uint8_t val) { _irq_latch = val; }
+    void write_irq_reload(uint8_t val);
+    void write_irq_disable(uint8_t val);
+    void write_irq_enable(uint8_t val) { _irq_enabled = true; }
 
-private:
-    nes_ppu * _ppu;
-    nes_memory *_mem;
+    // Map windows from bank registers in the current bank select mode
+    void update_prg_windows();
+    void update_chr_windows();
 
-    uint8_t *_prg_rom;
-    std::size_t _prg_rom_size;
-    uint8_t *_chr_rom;
-    std::size_t _chr_rom_size;
-    bool _vertical_mirroring;
+private:
+    nes_cpu *_cpu;
 
     uint8_t _bank_select;                       // control register
-    uint8_t _prev_prg_mode;                     // previous prg mode
+    uint8_t _banks[8];                          // bank registers R0~R7
+
+    uint8_t _irq_latch;                         // counter reload value
+    uint8_t _irq_counter;                       // scanline counter - decremented on every A12 rise
+    bool _irq_reload;                           // reload counter on the next A12 rise
+    bool _irq_enabled;
+};
+
+//
+// iNES Mapper 7
+// http://wiki.nesdev.com/w/index.php/AxROM
+//
+class nes_mapper_axrom final : public nes_bank_mapper<0x8000, 1, 0x2000, 1>
+{
+public :
+    using nes_bank_mapper::nes_bank_mapper;
+
+    virtual void on_load_ram(nes_memory &mem);
+    virtual void on_load_ppu(nes_ppu &ppu);
+    virtual void get_info(nes_mapper_info &info);
+
+    virtual void write_reg(uint16_t addr, uint8_t val);
 };
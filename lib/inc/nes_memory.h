@@ -1,8 +1,10 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <memory>
+#include <type_traits>
 
 #include <common.h>
 #include <nes_component.h>
@@ -11,6 +13,11 @@
 using namespace std;
 
 #define RAM_SIZE 0x10000
+#define PAGE_SIZE 0x100
+#define PAGE_COUNT (RAM_SIZE / PAGE_SIZE)
+#define PRG_ROM_START 0x8000
+#define PRG_BANK_SIZE 0x2000
+#define PRG_BANK_SLOT_COUNT ((RAM_SIZE - PRG_ROM_START) / PRG_BANK_SIZE)
 
 class nes_mapper;
 class nes_ppu;
@@ -33,13 +40,14 @@ public :
     uint8_t read_io_reg(uint16_t addr);
     void write_io_reg(uint16_t addr, uint8_t val);
 
+    // Plain RAM/ROM pages are one indexed load - only IO and mapper register pages go through a handler
     uint8_t get_byte(uint16_t addr)
     {
-        redirect_addr(addr);
-        if (is_io_reg(addr))
-            return read_io_reg(addr);
+        const uint8_t *page = _read_pages[addr >> 8];
+        if (page)
+            return page[addr & 0xff];
 
-        return _ram[addr];
+        return (this->*_read_handlers[addr >> 8])(addr);
     }
 
     uint16_t get_word(uint16_t addr)
@@ -48,8 +56,21 @@ public :
         return get_byte(addr) + (uint16_t(get_byte(addr + 1)) << 8);
     }
 
-    void set_byte(uint16_t addr, uint8_t val);
+    void set_byte(uint16_t addr, uint8_t val)
+    {
+        _side_effect_count++;
+
+        uint8_t *page = _write_pages[addr >> 8];
+        if (page)
+        {
+            page[addr & 0xff] = val;
+            return;
+        }
 
+        (this->*_write_handlers[addr >> 8])(addr, val);
+    }
+
+    // Copy into RAM - used for running programs without a mapper
     void set_bytes(uint16_t addr, uint8_t *data, size_t size)
     {
         assert(size + addr <= RAM_SIZE);
@@ -57,11 +78,62 @@ public :
         memcpy_s(&_ram[0] + addr, RAM_SIZE - addr, data, size);
     }
 
+    // Map the PRG ROM at prg_rom + offset into addr. Nothing gets copied - the 8KB slots of $8000~$ffff point
+    // straight into PRG ROM so that bank switching is a few pointer stores. This is how mappers switch banks
+    void set_prg_bytes(uint16_t addr, const uint8_t *prg_rom, size_t offset, size_t size)
+    {
+        assert(addr >= PRG_ROM_START && addr % PRG_BANK_SIZE == 0 && size % PRG_BANK_SIZE == 0);
+
+        for (size_t i = 0; i < size; i += PRG_BANK_SIZE)
+        {
+            int slot = (addr + i - PRG_ROM_START) / PRG_BANK_SIZE;
+            _prg_banks[slot] = uint16_t((offset + i) / PRG_BANK_SIZE);
+
+            const uint8_t *bank = prg_rom + offset + i;
+            if (_prg_slots[slot] == bank)
+                continue;
+
+            _prg_slots[slot] = bank;
+            for (int page = 0; page < PRG_BANK_SIZE / PAGE_SIZE; ++page)
+                _read_pages[(PRG_ROM_START + slot * PRG_BANK_SIZE) / PAGE_SIZE + page] = bank + page * PAGE_SIZE;
+
+            // Code at these addresses is different now
+            ++_prg_generation;
+        }
+    }
+
+    // 8KB PRG bank currently mapped at addr ($8000~$ffff)
+    uint16_t prg_bank(uint16_t addr)
+    {
+        assert(addr >= PRG_ROM_START);
+        return _prg_banks[(addr - PRG_ROM_START) / PRG_BANK_SIZE];
+    }
+
+    // Goes through the page table so that PRG ROM is read from wherever it is mapped
     void get_bytes(uint8_t *dest, uint16_t dest_size, uint16_t src_addr, size_t src_size)
     {
         assert(src_addr + src_size <= RAM_SIZE);
-        redirect_addr(src_addr);
-        memcpy_s(dest, dest_size, &_ram[0] + src_addr, src_size);
+        while (src_size > 0)
+        {
+            size_t size = min(src_size, size_t(PAGE_SIZE - src_addr % PAGE_SIZE));
+            const uint8_t *src = _read_pages[src_addr / PAGE_SIZE];
+            if (src)
+            {
+                src += src_addr % PAGE_SIZE;
+            }
+            else
+            {
+                uint16_t addr = src_addr;
+                redirect_addr(addr);
+                src = &_ram[0] + addr;
+            }
+
+            memcpy_s(dest, dest_size, src, size);
+            dest += size;
+            dest_size -= uint16_t(size);
+            src_addr += uint16_t(size);
+            src_size -= size;
+        }
     }
 
     void set_word(uint16_t addr, uint16_t value)
@@ -85,7 +157,36 @@ public :
         }
     }
 
-    void load_mapper(nes_mapper *mapper);
+    // Mapper is taken with its concrete (final) type so that register writes call it directly instead of going
+    // through the nes_mapper vtable
+    template <typename mapper_t>
+    void load_mapper(mapper_t *mapper)
+    {
+        static_assert(std::is_final<mapper_t>::value, "mapper needs to be final to devirtualize write_reg");
+        load_mapper(mapper, &nes_memory::write_mapper_reg<mapper_t>);
+    }
+
+    // Rebuild the page table - needs to be called whenever the memory layout changes (such as bank switch)
+    void build_page_table();
+
+    // Changes whenever a different bank gets mapped into $8000~$ffff - CPU uses it to look up the decoded
+    // instructions of the banks mapped now
+    uint32_t prg_generation() { return _prg_generation; }
+
+    // Changes whenever a mapper gets loaded - bank numbers then refer to a different PRG ROM
+    uint32_t prg_rom_generation() { return _prg_rom_generation; }
+
+    // Whether addr ($8000~$ffff) is mapped to PRG ROM - otherwise it is RAM (no mapper), which can change anytime
+    bool is_prg_rom(uint16_t addr)
+    {
+        assert(addr >= PRG_ROM_START);
+        return _prg_slots[(addr - PRG_ROM_START) / PRG_BANK_SIZE] != nullptr;
+    }
+
+    // Number of writes and IO reads with side effects so far - CPU uses it to detect idle loops
+    // PPUSTATUS reads are counted separately as polling it doesn't change anything until PPU status changes
+    uint32_t side_effect_count() { return _side_effect_count; }
+    uint32_t status_read_count() { return _status_read_count; }
 
     nes_mapper& get_mapper() { return *_mapper; }
 
@@ -104,8 +205,49 @@ public :
         // Do nothing
     }
 
+private :
+    typedef uint8_t (nes_memory::*nes_mem_read_handler)(uint16_t addr);
+    typedef void (nes_memory::*nes_mem_write_handler)(uint16_t addr, uint8_t val);
+
+    uint8_t read_io_page(uint16_t addr);
+    void write_io_page(uint16_t addr, uint8_t val);
+    void write_mapper_page(uint16_t addr, uint8_t val);
+
+    // Pages entirely made of mapper registers
+    template <typename mapper_t>
+    void write_mapper_reg(uint16_t addr, uint8_t val)
+    {
+        // Mappers can switch CHR banks and mirroring
+        sync_ppu();
+        static_cast<mapper_t *>(_mapper)->write_reg(addr, val);
+
+        // IRQ counter might fire at a different time now
+        if (mapper_t::has_a12_counter)
+            reschedule();
+    }
+
+    void load_mapper(nes_mapper *mapper, nes_mem_write_handler write_reg);
+
+    void sync_ppu();
+    void reschedule();
+
 private :
     array<uint8_t, RAM_SIZE> _ram;
+
+    // Each 256-byte page either points directly into host memory, or is null and goes to the handler
+    const uint8_t *_read_pages[PAGE_COUNT];
+    uint8_t *_write_pages[PAGE_COUNT];
+    nes_mem_read_handler _read_handlers[PAGE_COUNT];
+    nes_mem_write_handler _write_handlers[PAGE_COUNT];
+
+    uint16_t _prg_banks[PRG_BANK_SLOT_COUNT];   // 8KB PRG bank number in each slot of $8000~$ffff
+    const uint8_t *_prg_slots[PRG_BANK_SLOT_COUNT];   // PRG ROM mapped in each slot of $8000~$ffff - null means _ram
+
+    uint32_t _prg_generation;
+    uint32_t _prg_rom_generation;
+    uint32_t _side_effect_count;
+    uint32_t _status_read_count;
+
     nes_mapper *_mapper;
 
     nes_system *_system;
@@ -113,5 +255,6 @@ private :
     nes_input *_input;
 
     nes_mapper_info _mapper_info;
+    nes_mem_write_handler _write_mapper_reg;       // write_mapper_reg for the loaded mapper
 };
 
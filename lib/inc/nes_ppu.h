@@ -1,7 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
+#include <type_traits>
 
 #include <common.h>
 #include <nes_component.h>
@@ -13,6 +15,24 @@
 // http://wiki.nesdev.com/w/index.php/PPU_memory_map
 #define PPU_VRAM_SIZE 0x4000
 
+// Pattern tables at $0000~$1fff - 512 tiles of 16 bytes each (8 rows x 2 bitplanes)
+// http://wiki.nesdev.com/w/index.php/PPU_pattern_tables
+#define PPU_PATTERN_TABLE_SIZE 0x2000
+#define PPU_TILE_COUNT (PPU_PATTERN_TABLE_SIZE / 0x10)
+
+// $0000~$3eff is mapped in 1KB pages - 8 CHR pages followed by 4 name table pages ($3000~$3eff mirrors them)
+// http://wiki.nesdev.com/w/index.php/PPU_nametables
+#define PPU_VRAM_PAGE_SIZE 0x400
+#define PPU_VRAM_PAGE_COUNT (PPU_VRAM_SIZE / PPU_VRAM_PAGE_SIZE)
+#define PPU_NAME_TABLE_ADDR 0x2000
+#define PPU_NAME_TABLE_PAGE_COUNT 4
+#define PPU_NAME_TABLE_RAM_SIZE 0x800
+
+// Palette RAM at $3f00~$3f1f - 16 background colors followed by 16 sprite colors
+// http://wiki.nesdev.com/w/index.php/PPU_palettes
+#define PPU_PALETTE_ADDR 0x3f00
+#define PPU_PALETTE_SIZE 0x20
+
 // OAM (Object Attribute Memory) - internal memory inside PPU for 64 sprites of 4 bytes each
 // wiki.nesdev.com/w/index.php/PPU_OAM
 #define PPU_OAM_SIZE 0x100
@@ -85,6 +105,7 @@
 #define PPU_SCREEN_Y 240
 
 #define PPU_SCANLINE_COUNT 262
+#define PPU_FRAME_CYCLE (PPU_SCANLINE_COUNT * PPU_SCANLINE_CYCLE.count())
 
 // Only max of 8 sprites can be drawn in one scanlinekkkkk
 #define PPU_ACTIVE_SPRITE_MAX 0x8
@@ -95,11 +116,29 @@
 #define PPU_SPRITE_ATTR_HORIZONTAL_FLIP 0x40
 #define PPU_SPRITE_ATTR_VERTICAL_FLIP 0x80
 
+// 64 NES colors x 8 combinations of PPUMASK emphasis bits
+#define PPU_COLOR_COUNT 0x40
+#define PPU_EMPHASIS_COLOR_COUNT (PPU_COLOR_COUNT * 8)
+
+// Triple buffering - see acquire_frame
+#define PPU_FRAME_BUFFER_COUNT 3
+#define PPU_FRAME_SIZE (PPU_SCREEN_X * PPU_SCREEN_Y)
+#define PPU_FRAME_FRESH 0x4             // flag in _latest_frame - the latest frame hasn't been acquired yet
+
 class nes_system;
 class nes_mapper;
 
 using namespace std;
 
+// Pixel format of host output buffer - see nes_ppu::set_output
+enum nes_pixel_format
+{
+    nes_pixel_format_indexed,       // 1 byte - NES color index, same as frame_buffer() (it is frame_buffer() if
+                                    // rows aren't padded)
+    nes_pixel_format_argb8888,      // 4 bytes
+    nes_pixel_format_rgb565,        // 2 bytes
+};
+
 enum nes_ppu_state
 {
     nes_ppu_state_power_on,     // initial
@@ -137,11 +176,41 @@ public :
     void init();
 
     void step_ppu(nes_ppu_cycle_t cycle);
+
+    // The next cycle where PPU changes state that CPU can observe without accessing PPU registers
+    nes_cycle_t next_event_cycle();
+
+    // The earliest cycle after since where PPUSTATUS might read differently
+    nes_cycle_t next_status_change_cycle(nes_cycle_t since);
+
+    // Cycles until the A12 rise where mapper raises IRQ - -1 if it won't
+    int64_t cycles_until_irq();
     void fetch_tile();
+    void fetch_tile(int tile, uint16_t cur_scanline);
+    void fetch_name_table_byte();
+    void fetch_attribute_byte();
+    void fetch_pattern_row(uint16_t cur_scanline);
+    void render_tile(int tile, uint16_t cur_scanline);
+    void increment_x();
+    void increment_y();
+    void reset_x();
     void fetch_tile_pipeline();
     void fetch_sprite_pipeline();
+    void clear_sprite_buf();
+    void evaluate_sprite(uint8_t sprite_id);
+    void evaluate_sprites();
+    void build_sprite_index();
     void fetch_sprite(uint8_t sprite_id);
 
+    // Render current scanline in one call - see step_to for when it can be used
+    void render_scanline();
+
+    // render_scanline for skipped frames - only what sprite overflow / sprite 0 hit depend on
+    void skip_scanline();
+
+    // Frame wrap - publish the frame if it is rendered and decide whether to render the next one
+    void end_frame();
+
     bool is_ready() { return _master_cycle > nes_ppu_cycle_t(29658); }
 
     void stop_after_frame(uint32_t frame)
@@ -152,27 +221,84 @@ public :
 
     bool is_render_off() { return !_show_bg && !_show_sprites; }
 
-    void load_mapper(nes_mapper *mapper);
+    // Mappers with a scanline counter get their A12 rises through the concrete type - no calls for the rest
+    template <typename mapper_t>
+    void load_mapper(mapper_t *mapper)
+    {
+        static_assert(std::is_final<mapper_t>::value, "mapper needs to be final to devirtualize A12 counter");
+        if (mapper_t::has_a12_counter)
+            load_mapper(mapper, &nes_ppu::a12_rise<mapper_t>, &nes_ppu::a12_rises_until_irq<mapper_t>);
+        else
+            load_mapper(mapper, nullptr, nullptr);
+    }
 
     void set_mirroring(nes_mapper_flags flags);
 
-    uint8_t *frame_buffer()
+    //
+    // Frames are triple buffered so that whoever presents them can live on another thread without locks:
+    // PPU renders into one buffer, one holds the latest completed frame and one is held by the consumer
+    // PPU publishes a frame by exchanging its buffer with the latest one - it never waits on the consumer
+    // Until there is a consumer (acquire_frame / set_output) all three are the same buffer, so headless runs
+    // only pay for one. The first acquire_frame needs to happen before PPU runs on another thread
+    //
+
+    // Consumer side - take the latest completed frame if there is a newer one than what we are holding.
+    // Returns false if there isn't. frame_buffer() / output_buffer() / frame_sequence() then refer to the
+    // held frame until the next acquire_frame
+    bool acquire_frame()
     {
-        // Return the completed buffer
-        if (_frame_buffer == _frame_buffer_1)
-            return _frame_buffer_2;
-        else
-            return _frame_buffer_1;
+        if (_frame_buffers[0] == _frame_buffers[1])
+            allocate_frame_buffers();
+
+        if (!(_latest_frame.load(memory_order_relaxed) & PPU_FRAME_FRESH))
+            return false;
+
+        _read_frame = _latest_frame.exchange(_read_frame, memory_order_acq_rel) & ~PPU_FRAME_FRESH;
+        return true;
     }
 
+    uint8_t *frame_buffer() { return _frame_buffers[_read_frame]; }
+
+    // Host buffer of the held frame - see set_output
+    void *output_buffer() { return _outputs[_read_frame]; }
+
+    // Sequence number of the held frame - 1 for the first completed frame, 0 if none is held yet
+    uint32_t frame_sequence() { return _frame_sequences[_read_frame]; }
+
+    //
+    // Frame skipping for fast-forward / headless runs - takes effect from the next frame
+    // Skipped frames still keep vblank, sprite overflow and sprite 0 hit exact, but nothing is written into the
+    // frame buffers and they are not published - acquire_frame won't see them
+    //
+    void set_render(bool render) { _render = render; }
+
+    // PPU side - publish the completed frame and continue with whichever buffer was the latest
     void swap_buffer()
     {
-        if (_frame_buffer == _frame_buffer_1)
-            _frame_buffer = _frame_buffer_2;
-        else
-            _frame_buffer = _frame_buffer_1;
+        _frame_sequences[_write_frame] = _frame_count + 1;
+        _write_frame = _latest_frame.exchange(_write_frame | PPU_FRAME_FRESH, memory_order_acq_rel) & ~PPU_FRAME_FRESH;
+
+        _frame_buffer = _frame_buffers[_write_frame];
+        _output = _set_output_pixel ? _outputs[_write_frame] : nullptr;
+        _pixel_row = -1;
     }
 
+    //
+    // Have PPU also write every pixel directly into host buffers in the given format, with emphasis and
+    // grayscale applied - so that there is no need to convert frame_buffer() afterwards
+    // Just like frame_buffer(), the three buffers are used for triple buffering - see output_buffer()
+    // Each row is pitch bytes. Pass nullptr buffers to turn this off. Needs to be called after power_on
+    // Indexed buffers without padding (pitch = PPU_SCREEN_X) simply become the frame buffers
+    //
+    void set_output(nes_pixel_format format, void *buffer_1, void *buffer_2, void *buffer_3, size_t pitch);
+
+private :
+    // Give each frame buffer its own storage - see acquire_frame
+    void allocate_frame_buffers();
+
+    // Point _frame_buffers at host buffers (see set_output) or _frame_storage
+    void map_frame_buffers();
+
 public :
 
     //
@@ -180,62 +306,71 @@ public :
     //
     uint8_t read_byte(uint16_t addr)
     {
-        redirect_addr(addr);
-
         if (addr >= PPU_VRAM_SIZE)
             return 0xff;
 
-        return _vram[addr];
+        if (addr >= PPU_PALETTE_ADDR)
+            return _palette_ram[get_palette_ram_index(addr)];
+
+        return _read_pages[addr / PPU_VRAM_PAGE_SIZE][addr % PPU_VRAM_PAGE_SIZE];
     }
 
     void write_byte(uint16_t addr, uint8_t val)
     {
-        redirect_addr(addr);
-
         if (addr >= PPU_VRAM_SIZE)
             return;
 
-        _vram[addr] = val;
+        if (addr >= PPU_PALETTE_ADDR)
+        {
+            _palette_ram[get_palette_ram_index(addr)] = val;
+            update_palette();
+            return;
+        }
+
+        _write_pages[addr / PPU_VRAM_PAGE_SIZE][addr % PPU_VRAM_PAGE_SIZE] = val;
+
+        // CHR-RAM write
+        if (addr < PPU_PATTERN_TABLE_SIZE)
+            invalidate_tiles(addr, 1);
     }
 
-    void write_bytes(uint16_t addr, uint8_t *src, size_t src_size)
+    //
+    // Map CHR ROM at chr_rom into PPU $0000~$1fff starting at addr - this is how mappers switch CHR banks
+    // Only the page pointers change. CHR ROM is read-only so writes to these pages are dropped
+    //
+    void set_chr_bank(uint16_t addr, const uint8_t *chr_rom, size_t size)
     {
-        if (addr + src_size > PPU_VRAM_SIZE)
+        assert(addr % PPU_VRAM_PAGE_SIZE == 0 && size % PPU_VRAM_PAGE_SIZE == 0);
+        if (addr + size > PPU_PATTERN_TABLE_SIZE)
             return;
 
-        redirect_addr(addr);
-        memcpy_s(_vram.data() + addr, PPU_VRAM_SIZE - addr, src, src_size);
+        for (size_t i = 0; i < size; i += PPU_VRAM_PAGE_SIZE)
+        {
+            int page = (addr + i) / PPU_VRAM_PAGE_SIZE;
+            if (_read_pages[page] == chr_rom + i)
+                continue;
+
+            _read_pages[page] = chr_rom + i;
+            _write_pages[page] = _dummy_page;
+            invalidate_tiles(uint16_t(addr + i), PPU_VRAM_PAGE_SIZE);
+        }
     }
 
-    void redirect_addr(uint16_t &addr)
+    // Name table / attribute fetches during rendering never hit the palette so it is a plain page lookup
+    uint8_t read_name_table_byte(uint16_t addr)
     {
-        if ((addr & 0xff00) == 0x3f00)
-        {
-            // mirror of palette table every 0x20 bytes
-            addr &= 0xff1f;
+        assert(addr >= PPU_NAME_TABLE_ADDR && addr < PPU_PALETTE_ADDR);
+        return _read_pages[addr / PPU_VRAM_PAGE_SIZE][addr % PPU_VRAM_PAGE_SIZE];
+    }
 
-            // mirror special case 0x3f10 = 0x3f00, 0x3f14 = 0x3f04, ...
-            if ((addr & 0xfff3) == 0x3f10)
-                addr &= 0x3f0f;
-        }
-        else if ((addr & 0xf000) == 0x2000)
-        {
-            // name table mirroring
-            if (_mirroring_flags == nes_mapper_flags_vertical_mirroring)
-                addr &= 0xf7ff;     // $2000=$2800, $2400=$2c00
-            else if (_mirroring_flags == nes_mapper_flags_horizontal_mirroring)
-                addr &= 0xfbff;     // $2000=$2400, $2800=$2c00
-            else if (_mirroring_flags == nes_mapper_flags_one_screen_lower_bank)
-                addr &= 0xf3ff;     // $2000 mapped to all the other 3
-            else if (_mirroring_flags == nes_mapper_flags_one_screen_upper_bank)
-                addr = (addr & 0xf3ff) | 0x400; // $2400 mapped to all the other 3
-            else assert(!"Unsupported mirroring modes");
-        }
-        else if (addr >= 0x3000)
-        {
-            // 0x3000~0x3f00 mirrors to 0x2000~0x2f00
-            addr -= 0x1000;
-        }
+    // $3f10/$3f14/$3f18/$3f1c mirror $3f00/$3f04/$3f08/$3f0c and the whole thing mirrors every 0x20 bytes
+    uint8_t get_palette_ram_index(uint16_t addr)
+    {
+        uint8_t index = addr & (PPU_PALETTE_SIZE - 1);
+        if ((index & 0x13) == 0x10)
+            index &= 0xf;
+
+        return index;
     }
 
     // Avoid destructive reads for PPU registers
@@ -277,13 +412,15 @@ public :
         _name_tbl_addr = 0x2000 + uint16_t(name_table_addr_bit) * 0x400;
 
         _bg_pattern_tbl_addr = (val & PPUCTRL_BACKGROUND_PATTERN_TABLE_ADDRESS_MASK) << 0x8;
-        _sprite_pattern_tbl_addr = (val & PPUCTRL_SPRITE_PATTERN_TABLE_ADDR_MASK) << 0x8;
+        _sprite_pattern_tbl_addr = (val & PPUCTRL_SPRITE_PATTERN_TABLE_ADDR_MASK) << 0x9;
 
         _use_8x16_sprite = val & PPUCTRL_SPRITE_SIZE_MASK;
-        if (_use_8x16_sprite)
-            _sprite_height = 16;
-        else
-            _sprite_height = 8;
+        uint8_t sprite_height = _use_8x16_sprite ? 16 : 8;
+        if (sprite_height != _sprite_height)
+        {
+            _sprite_height = sprite_height;
+            _sprite_index_dirty = true;
+        }
 
         _ppu_addr_inc = (val & PPUCTRL_VRAM_ADDR_MASK) ? 0x20 : 1;
 
@@ -301,7 +438,16 @@ public :
 
         _show_bg = val & PPUMASK_SHOW_BACKGROUND;
         _show_sprites = val & PPUMASK_SHOW_SPRITES;
-        _gray_scale_mode = val & PPUMASK_GRAYSCALE;
+
+        // Both change the final colors
+        bool gray_scale_mode = val & PPUMASK_GRAYSCALE;
+        uint8_t emphasis = (val & (PPUMASK_EMPHASIZE_RED | PPUMASK_EMPHASIZE_GREEN | PPUMASK_EMPHASIZE_BLUE)) >> 5;
+        if (gray_scale_mode != _gray_scale_mode || emphasis != _emphasis)
+        {
+            _gray_scale_mode = gray_scale_mode;
+            _emphasis = emphasis;
+            update_palette();
+        }
     }
 
     uint8_t read_PPUSTATUS()
@@ -340,6 +486,7 @@ public :
 
         _oam[_oam_addr] = val;
         _oam_addr++;
+        _sprite_index_dirty = true;
     }
 
     uint8_t read_OAMDATA()
@@ -447,6 +594,63 @@ private :
         uint8_t pos_x;
     };
 
+    // Current position within the frame, in cycles
+    int64_t frame_pos() { return _cur_scanline * PPU_SCANLINE_CYCLE.count() + _scanline_cycle.count(); }
+
+    // Number of cycles from frame position pos until PPU gets to scanline_cycle in scanline next time
+    static int64_t cycles_until(int64_t pos, int scanline, int scanline_cycle);
+
+    // Cycles until the next dot that does something while PPU isn't drawing
+    int64_t cycles_until_idle_event();
+
+    typedef void (nes_ppu::*nes_ppu_a12_rise_handler)();
+    typedef int (nes_ppu::*nes_ppu_a12_count_handler)();
+
+    void load_mapper(nes_mapper *mapper, nes_ppu_a12_rise_handler a12_rise, nes_ppu_a12_count_handler a12_count);
+
+    template <typename mapper_t>
+    void a12_rise() { static_cast<mapper_t *>(_mapper)->on_a12_rise(); }
+
+    template <typename mapper_t>
+    int a12_rises_until_irq() { return static_cast<mapper_t *>(_mapper)->a12_rises_until_irq(); }
+
+    //
+    // Rather than watching A12 for every fetch, assume background and sprites fetch from one side of the
+    // pattern tables each (as games relying on the MMC3 counter do) - A12 then rises exactly once per
+    // rendered scanline (0~239 and pre-render), at the first fetch from $1000:
+    // * sprites at $1000 (or 8x16 sprites), background at $0000: dot 260 - sprite fetches
+    // * background at $1000, sprites at $0000: dot 324 - prefetching the first tile of next line
+    // Returns -1 if there are no rises - both use the same side or rendering is off
+    // 8x16 sprites are a known approximation: each sprite picks its side with bit 0 of its tile, so these are
+    // always taken as $1000. That is right for empty sprite slots (tile $FF) and games putting 8x16 sprites in
+    // odd tiles, but a line with only even-tile sprites has no rise from them, and a first odd-tile sprite in a
+    // later slot rises 8 dots later per slot
+    //
+    int a12_rise_dot()
+    {
+        if (is_render_off())
+            return -1;
+
+        bool sprite_high = _use_8x16_sprite || (_sprite_pattern_tbl_addr & 0x1000);
+        bool bg_high = _bg_pattern_tbl_addr & 0x1000;
+        if (sprite_high == bg_high)
+            return -1;
+
+        return sprite_high ? 260 : 324;
+    }
+
+    static bool is_a12_rise_scanline(int scanline)
+    {
+        return scanline < PPU_SCREEN_Y || scanline == PPU_SCANLINE_COUNT - 1;
+    }
+
+    // Sprites in range of one scanline, in OAM order - see build_sprite_index
+    struct sprite_line
+    {
+        uint8_t count;                                  // all sprites in range - can go beyond 8
+        uint8_t sprite_ids[PPU_ACTIVE_SPRITE_MAX];      // only the first 8 since that's all PPU can draw
+    };
+
     sprite_info *get_sprite(uint8_t sprite_id)
     {
         assert(sprite_id < PPU_SPRITE_MAX);
@@ -455,25 +659,92 @@ private :
         return &((sprite_info *)_oam.data())[sprite_id];
     }
 
-    uint8_t get_palette_color(bool is_background, uint8_t palette_index_4_bit)
+    uint8_t get_palette_index(bool is_background, uint8_t palette_index_4_bit)
+    {
+        return (is_background ? 0 : 0x10) | palette_index_4_bit;
+    }
+
+    // Point _frame_row / _output_row at scanline - they only change with the scanline (and buffer swaps / output
+    // changes, which reset _pixel_row) so this is once per scanline instead of a divide for every pixel
+    void select_pixel_row(int scanline)
+    {
+        if (scanline == _pixel_row)
+            return;
+
+        _pixel_row = scanline;
+        _frame_row = _frame_buffer + scanline * PPU_SCREEN_X;
+        _output_row = _output ? _output + scanline * _output_pitch : nullptr;
+    }
+
+    // Write the color of palette_index (see get_palette_index) into pixel x of the selected row, and host
+    // buffer if any
+    void set_pixel(uint8_t x, uint8_t palette_index)
+    {
+        if (!_render_frame)
+            return;
+
+        _frame_row[x] = _palette[palette_index];
+
+        if (_output_row)
+            (this->*_set_output_pixel)(x, palette_index);
+    }
+
+    typedef void (nes_ppu::*nes_ppu_output_pixel_handler)(uint8_t x, uint8_t palette_index);
+
+    // Picked by set_output once per format
+    template <nes_pixel_format format>
+    void set_output_pixel(uint8_t x, uint8_t palette_index)
+    {
+        switch (format)
+        {
+        case nes_pixel_format_indexed:
+            _output_row[x] = _palette[palette_index];
+            break;
+        case nes_pixel_format_argb8888:
+            ((uint32_t *)_output_row)[x] = _output_palette[palette_index];
+            break;
+        case nes_pixel_format_rgb565:
+            ((uint16_t *)_output_row)[x] = uint16_t(_output_palette[palette_index]);
+            break;
+        }
+    }
+
+    // Resolve all 32 entries of _palette from palette RAM - needs to be called whenever palette RAM or PPUMASK
+    // changes
+    void update_palette()
     {
-        // There is only one universal backdrop color doesn't matter which background it is
-        if ((palette_index_4_bit & 0x3) == 0)
-            return read_byte(0x3f00);
+        // Nobody sees the colors of a skipped frame - resolve them when rendering resumes
+        _palette_dirty = !_render_frame;
+        if (_palette_dirty)
+            return;
+
+        for (uint16_t i = 0; i < PPU_PALETTE_SIZE; ++i)
+        {
+            // There is only one universal backdrop color doesn't matter which background it is
+            // This also takes care of $3f10/$3f14/$3f18/$3f1c mirroring $3f00/$3f04/$3f08/$3f0c
+            if ((i & 0x3) == 0)
+                _palette[i] = _palette_ram[0];
+            else
+                _palette[i] = _palette_ram[i];
 
-        uint16_t palette_addr = (is_background ? 0x3f00 : 0x3f10) | palette_index_4_bit;
-        return read_byte(palette_addr);
+            // Grayscale only keeps the column 0 of the color - $00, $10, $20, $30
+            if (_gray_scale_mode)
+                _palette[i] &= 0x30;
+
+            _output_palette[i] = _output_colors[(_emphasis * PPU_COLOR_COUNT) | (_palette[i] % PPU_COLOR_COUNT)];
+        }
     }
 
-    uint8_t read_pattern_table_column(bool sprite, uint8_t tile_index, uint8_t bitplane, uint8_t tile_row_index)
+    // Address of bitplane 0 of the tile row in pattern table
+    uint16_t get_pattern_row_addr(bool sprite, uint8_t tile_index, uint8_t tile_row_index)
     {
         uint16_t tile_addr = sprite ? _sprite_pattern_tbl_addr : _bg_pattern_tbl_addr;
         tile_addr |= (tile_index << 4);
 
-        return read_byte(tile_addr | (bitplane << 3) | tile_row_index);
+        return tile_addr | tile_row_index;
     }
 
-    uint8_t read_pattern_table_column_8x16_sprite(uint8_t tile_index, uint8_t bitplane, uint8_t tile_row_index)
+    uint16_t get_pattern_row_addr_8x16_sprite(uint8_t tile_index, uint8_t tile_row_index)
     {
         // TTTTTTB - T is tile number and B is tile pattern table select $0000 or $1000
         uint16_t tile_addr = ((uint16_t(tile_index) & 0x1) << 12) | ((uint16_t(tile_index) & ~0x1) << 4);
@@ -483,15 +754,73 @@ private :
         // 8-f: bitplane 1 for top tile       --> tile row index 0-7
         // 10-17: bitplane 0 for bottom tile  --> tile row index 8-f
         // 18-1f: bitplane 1 for bottom tile  --> tile row index 8-f
-        return read_byte(tile_addr | (bitplane << 3) | (tile_row_index & 0x7) | ((tile_row_index & 0x8) << 1));
+        return tile_addr | (tile_row_index & 0x7) | ((tile_row_index & 0x8) << 1);
+    }
+
+    // The tile row at row_addr as 8 2-bit palette indices (bitplane1 << 1 | bitplane0), left to right
+    // Both bitplanes are decoded together - so this is one lookup instead of two reads and 8 shifts
+    const uint8_t *read_pattern_row(uint16_t row_addr, bool horizontal_flip)
+    {
+        uint16_t tile = row_addr >> 4;
+        if (!_tile_cache_valid[tile])
+            decode_tile(tile);
+
+        return _tile_cache[tile][horizontal_flip][row_addr & 0x7];
+    }
+
+    void decode_tile(uint16_t tile);
+
+    // Opaque background pixels pos_x~pos_x+7 of scanline as bit 0~7
+    uint8_t get_bg_opaque(uint16_t scanline, uint8_t pos_x)
+    {
+        // there is no background to hit when it is not rendered
+        if (!_show_bg)
+            return 0;
+
+        const uint64_t *line = _bg_opaque[scanline & 1];
+        uint64_t bits = line[pos_x / 64] >> (pos_x % 64);
+        if (pos_x % 64 > 64 - 8 && pos_x / 64 < PPU_SCREEN_X / 64 - 1)
+            bits |= line[pos_x / 64 + 1] << (64 - pos_x % 64);
+
+        return uint8_t(bits);
+    }
+
+    void invalidate_tiles(uint16_t addr, size_t size)
+    {
+        size_t end = min(size_t(addr) + size, size_t(PPU_PATTERN_TABLE_SIZE));
+        for (size_t tile = addr >> 4; tile < (end + 0xf) >> 4; ++tile)
+            _tile_cache_valid[tile] = false;
     }
 
  private :
     nes_system *_system;
 
-    array<uint8_t, PPU_VRAM_SIZE> _vram;
+    // $0000~$3eff goes through these 1KB pages - mirroring and CHR bank switching only repoint them
+    const uint8_t *_read_pages[PPU_VRAM_PAGE_COUNT];
+    uint8_t *_write_pages[PPU_VRAM_PAGE_COUNT];
+
+    uint8_t _chr_ram[PPU_PATTERN_TABLE_SIZE];           // pattern tables when there is no CHR ROM mapped
+    uint8_t _name_table_ram[PPU_NAME_TABLE_RAM_SIZE];   // 2 physical name tables
+    uint8_t _palette_ram[PPU_PALETTE_SIZE];
+    uint8_t _dummy_page[PPU_VRAM_PAGE_SIZE];            // writes to CHR ROM land here
     array<uint8_t, PPU_OAM_SIZE> _oam;
 
+    // Decoded pattern table - [tile][horizontal flip][row][column]
+    uint8_t _tile_cache[PPU_TILE_COUNT][2][8][8];
+    bool _tile_cache_valid[PPU_TILE_COUNT];
+
+    // Colors of all 32 palette indices (bit 4 = sprite) with mirroring and backdrop already resolved
+    uint8_t _palette[PPU_PALETTE_SIZE];
+
+    // Host output
+    nes_pixel_format _output_format;
+    nes_ppu_output_pixel_handler _set_output_pixel;        // set_output_pixel<_output_format> - null if no host output
+    uint8_t *_output;                   // host buffer being rendered into - null if there is no host output
+    uint8_t *_outputs[PPU_FRAME_BUFFER_COUNT];             // host buffer of each frame buffer
+    size_t _output_pitch;
+    uint32_t _output_colors[PPU_EMPHASIS_COLOR_COUNT];     // host color of each emphasis x color combination
+    uint32_t _output_palette[PPU_PALETTE_SIZE];            // host color of _palette with current emphasis
+
     // PPUCTRL data
     uint16_t _name_tbl_addr;
     uint16_t _bg_pattern_tbl_addr;
@@ -505,6 +834,7 @@ private :
     bool _show_bg;
     bool _show_sprites;
     bool _gray_scale_mode;
+    uint8_t _emphasis;                  // PPUMASK emphasis bits - blue / green / red
 
     // PPUSTATUS
     uint8_t _latch;
@@ -544,12 +874,22 @@ private :
     // rendering states
     uint8_t _tile_index;                // tile index from name table - it consists of
     uint8_t _tile_palette_bit32;        // palette index bit 3/2 from attribute table
-    uint8_t _bitplane0;                 // bitplane0 of current tile from pattern table
-    uint8_t *_frame_buffer;             // entire frame buffer - only 4 bit is used
-    uint8_t _frame_buffer_1[PPU_SCREEN_Y * PPU_SCREEN_X];   // frame buffer 1 - used for double buffering
-    uint8_t _frame_buffer_bg[PPU_SCREEN_Y * PPU_SCREEN_X];  // sprite 0 hit detection
-    uint8_t _frame_buffer_2[PPU_SCREEN_Y * PPU_SCREEN_X];   // frame buffer 2 - used for double buffering
-    uint8_t _pixel_cycle[8];            // pixels in each cycle
+    const uint8_t *_tile_row;           // decoded pattern row of current tile - see read_pattern_row
+    uint8_t *_frame_buffer;             // frame buffer being rendered into - _frame_buffers[_write_frame]
+    uint8_t *_frame_buffers[PPU_FRAME_BUFFER_COUNT];    // NES colors of each pixel - _frame_storage or host buffers
+    unique_ptr<uint8_t[]> _frame_storage[PPU_FRAME_BUFFER_COUNT];  // only the first one until there is a consumer
+    int _pixel_row;                     // scanline _frame_row / _output_row are for - see select_pixel_row
+    uint8_t *_frame_row;                // row of _pixel_row in _frame_buffer
+    uint8_t *_output_row;               // row of _pixel_row in _output - null if there is no host output
+    uint32_t _frame_sequences[PPU_FRAME_BUFFER_COUNT];                  // sequence number of frame in each buffer
+    uint8_t _write_frame;               // buffer PPU renders into - only touched by PPU
+    atomic<uint8_t> _latest_frame;      // latest completed buffer | PPU_FRAME_FRESH - exchanged by both sides
+    uint8_t _read_frame;                // buffer held by consumer - only touched by consumer
+    bool _render;                       // render frames from the next one on - see set_render
+    bool _render_frame;                 // current frame is rendered
+    bool _palette_dirty;                // palette changed during skipped frames - see update_palette
+    uint64_t _bg_opaque[2][PPU_SCREEN_X / 64];  // bit x = background pixel x isn't palette 0, for this and next
+                                                // scanline (first 2 tiles are prefetched) - sprite 0 hit / priority
     uint8_t _shift_reg;                 // which bit do we care about
     uint8_t _x_offset;                  // current X offset
 
@@ -558,9 +898,11 @@ private :
     uint8_t _last_sprite_id;            // current max sprite ID
     bool _has_sprite_0;                 // first active sprite is sprite 0 - needed in sprite 0 hit detection
     bool _mask_oam_read;                // OAM read is masked at certain sprite evaluation stage to always return FF
+    sprite_line _sprite_lines[PPU_SCREEN_Y];    // sprites in range of each scanline
+    bool _sprite_index_dirty;           // OAM or sprite height changed since _sprite_lines was built
     uint8_t _sprite_pos_y;              // last sprite Y read
 
     nes_mapper *_mapper;
-
-    nes_mapper_flags _mirroring_flags;  // mapper flags masked by mirroring flags
+    nes_ppu_a12_rise_handler _a12_rise;             // a12_rise for the loaded mapper - null if it doesn't count
+    nes_ppu_a12_count_handler _a12_rises_until_irq; // a12_rises_until_irq for the loaded mapper
 };
\ No newline at end of file
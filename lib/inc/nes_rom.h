@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+//
+// ROM image (iNES file) - mappers and PPU point straight into it so it needs to outlive them
+// Files are mapped read-only whenever possible: loading is then just setting up the mapping, pages come in
+// on demand, and every system loading the same file shares one mapping (and one physical copy of it)
+// Otherwise the file is read into heap
+//
+class nes_rom
+{
+public :
+    // Map the file at path, or share the existing mapping if it is already loaded - throws if it can't be read
+    static shared_ptr<nes_rom> open(const char *path);
+
+    // Own a copy of the given bytes
+    static shared_ptr<nes_rom> copy(const uint8_t *data, size_t size);
+
+    ~nes_rom();
+
+    // Mapped images are read-only - writes into ROM are dropped (see nes_memory::write_mapper_page and
+    // nes_ppu::set_chr_bank)
+    const uint8_t *data() { return _data; }
+    size_t size() { return _size; }
+
+    bool is_mapped() { return _mapped; }
+
+private :
+    nes_rom() : _data(nullptr), _size(0), _mapped(false) {}
+
+    nes_rom(const nes_rom &) = delete;
+    nes_rom &operator=(const nes_rom &) = delete;
+
+    static shared_ptr<nes_rom> map(const char *path);
+
+private :
+    const uint8_t *_data;
+    size_t _size;
+    bool _mapped;                   // _data is a file mapping - otherwise it points into _heap
+    vector<uint8_t> _heap;
+};
@@ -7,6 +7,9 @@
 #include "nes_memory.h"
 #include "nes_mapper.h"
 #include "nes_input.h"
+#include "nes_rom.h"
+
+#include <memory>
 
 using namespace std;
 
@@ -40,6 +43,10 @@ public :
     void load_rom(uint8_t *rom_data, std::size_t rom_size, nes_rom_exec_mode mode);
     void run_rom(uint8_t *rom_data, std::size_t rom_size, nes_rom_exec_mode mode);
 
+    // Load the ROM file at rom_path - mapped rather than copied when possible, see nes_rom
+    void load_rom(const char *rom_path, nes_rom_exec_mode mode);
+    void run_rom(const char *rom_path, nes_rom_exec_mode mode);
+
     nes_cpu     *cpu()      { return &_cpu;   }
     nes_memory  *ram()      { return &_ram;   }
     nes_ppu     *ppu()      { return &_ppu;   }
@@ -53,11 +60,22 @@ public :
     // 2. Let CPU drive cycle - and other component "catch up"
     // 3. Let each component own their own thread - and synchronizes at cycle granuarity
     //
-    // I think option #1 will produce the most accurate timing without subjecting too much to OS resource
-    // management.
+    // We use option #2: CPU runs ahead freely, and PPU only catches up when CPU is about to observe/change
+    // PPU state (PPU registers, OAMDMA, mapper registers), or when PPU is about to raise an event on its own
+    // (NMI, end of frame). PPU is always at the exact cycle CPU sees it, so timing is the same as stepping
+    // both in lock step, without the round trips for every cycle.
+    // PPU is left behind at the end of step - it'll catch up at the next sync point, in longer runs of whole
+    // scanlines that it can render in one go (see nes_ppu::render_scanline).
     //
     void step(nes_cycle_t count);
 
+    // Let PPU catch up with CPU - needs to be called before CPU accesses any state shared with PPU
+    void sync_ppu() { _ppu.step_to(_cpu.cycle()); }
+
+    // PPU state that decides the next event (such as mapper IRQ counter) just changed - make sure CPU doesn't
+    // run past the new one. PPU needs to be synchronized already
+    void reschedule() { _cpu.shorten_run_to(_ppu.next_event_cycle()); }
+
     bool stop_requested() { return _stop_requested; }
 
 private :
@@ -66,7 +84,46 @@ private :
 
     void init();
 
-    void load_mapper(uint8_t *rom_data, std::size_t rom_size);
+    void load_rom(shared_ptr<nes_rom> rom, nes_rom_exec_mode mode);
+
+    // Throws if the image isn't large enough for what its header says, or the mapper isn't supported
+    void load_mapper(const uint8_t *rom_data, std::size_t rom_size);
+
+    //
+    // Mapper factory - every supported iNES mapper has an entry in s_mapper_registry, which creates the mapper
+    // in place in _mappers with its concrete type
+    //
+    typedef void (nes_system::*nes_mapper_factory)(const uint8_t *prg_rom, std::size_t prg_rom_size,
+                                                   const uint8_t *chr_rom, std::size_t chr_rom_size,
+                                                   bool vertical_mirroring);
+
+    struct nes_mapper_registration
+    {
+        int id;                             // iNES mapper number
+        const char *name;
+        nes_mapper_factory create;
+    };
+
+    static const nes_mapper_registration s_mapper_registry[];
+
+    template <typename mapper_t>
+    void create_mapper(const uint8_t *prg_rom, std::size_t prg_rom_size,
+                       const uint8_t *chr_rom, std::size_t chr_rom_size,
+                       bool vertical_mirroring)
+    {
+        static_assert(sizeof(mapper_t) <= sizeof(_mappers), "mapper needs to be in nes_mappers");
+        attach_mapper(new(&_mappers) mapper_t(prg_rom, prg_rom_size, chr_rom, chr_rom_size, vertical_mirroring));
+    }
+
+    // Concrete mapper type is only known here - memory uses it to call mapper registers without virtual calls
+    template <typename mapper_t>
+    void attach_mapper(mapper_t *mapper)
+    {
+        _mapper = mapper;
+        _ram.load_mapper(mapper);
+        _ppu.load_mapper(mapper);
+        mapper->on_load_cpu(_cpu);
+    }
 
 private :
     nes_cycle_t _master_cycle;              // keep count of current cycle
@@ -84,8 +141,13 @@ private :
 
         nes_mapper_nrom _nrom;
         nes_mapper_mmc1 _mmc1;
+        nes_mapper_uxrom _uxrom;
+        nes_mapper_cnrom _cnrom;
         nes_mapper_mmc3 _mmc3;
+        nes_mapper_axrom _axrom;
     } _mappers;
 
+    shared_ptr<nes_rom> _rom;               // mappers and PPU point straight into the ROM image
+
     bool _stop_requested;                   // useful for internal testing, or synchronization to rendering
 };
@@ -118,6 +118,8 @@ static ostream& operator <<(ostream &os, const string &str)
 #define NES_TRACE3(expr) NES_LOG_IF(nes_tracer_level_detail, expr);
 #define NES_TRACE4(expr) NES_LOG_IF(nes_tracer_level_diag, expr);
 
+#define NES_TRACE_IS_ENABLED(level) nes_tracer::get().is_enabled(level)
+
 #ifdef _DEBUG
 #define NES_DBG(expr) NES_LOG_IF(nes_tracer_level_debug, expr);
 #else
@@ -141,4 +143,6 @@ static ostream& operator <<(ostream &os, const string &str)
 #define NES_TRACE3(expr)
 #define NES_TRACE4(expr)
 
+#define NES_TRACE_IS_ENABLED(level) false
+
 #endif
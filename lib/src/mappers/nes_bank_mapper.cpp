@@ -0,0 +1,15 @@
+#include <nes_mapper.h>
+#include <nes_memory.h>
+#include <nes_ppu.h>
+
+void nes_bank_mapper_base::map_prg(uint16_t addr, std::size_t offset, std::size_t size)
+{
+    assert(offset + size <= _prg_rom_size);
+    _mem->set_prg_bytes(addr, _prg_rom, offset, size);
+}
+
+void nes_bank_mapper_base::map_chr(uint16_t addr, std::size_t offset, std::size_t size)
+{
+    assert(offset + size <= _chr_rom_size);
+    _ppu->set_chr_bank(addr, _chr_rom + offset, size);
+}
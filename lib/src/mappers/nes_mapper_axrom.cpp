@@ -0,0 +1,60 @@
+#include <nes_mapper.h>
+#include <nes_memory.h>
+#include <nes_ppu.h>
+
+#include <cstring>
+
+//
+// Called when mapper is loaded into memory
+// Useful for mapping the initial banks
+//
+void nes_mapper_axrom::on_load_ram(nes_memory &mem)
+{
+    _mem = &mem;
+
+    set_prg_window(0, 0);
+}
+
+//
+// Called when mapper is loaded into PPU
+// Useful for mapping the initial banks
+//
+void nes_mapper_axrom::on_load_ppu(nes_ppu &ppu)
+{
+    _ppu = &ppu;
+
+    // AxROM boards have CHR RAM - but map CHR ROM if there is any
+    set_chr_window(0, 0);
+}
+
+//
+// Returns various mapper related flags
+//
+void nes_mapper_axrom::get_info(nes_mapper_info &info)
+{
+    memset(&info, 0, sizeof(info));
+
+    info.code_addr = 0x8000;
+
+    info.reg_start = 0x8000;
+    info.reg_end = 0xffff;
+
+    // Mirroring in the header doesn't matter - it is one screen, selected by the register
+    info.flags = nes_mapper_flags(nes_mapper_flags_has_registers | nes_mapper_flags_one_screen_lower_bank);
+}
+
+/*
+Bank select ($8000-$FFFF)
+7  bit  0
+---- ----
+xxxM xPPP
+   |  |||
+   |  +++- Select 32 KB PRG ROM bank for CPU $8000-$FFFF
+   +------ Select 1 KB VRAM page for all 4 nametables
+*/
+void nes_mapper_axrom::write_reg(uint16_t addr, uint8_t val)
+{
+    set_prg_window(0, val & 0x7);
+
+    _ppu->set_mirroring((val & 0x10) ? nes_mapper_flags_one_screen_upper_bank : nes_mapper_flags_one_screen_lower_bank);
+}
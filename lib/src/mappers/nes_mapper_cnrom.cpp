@@ -0,0 +1,66 @@
+#include <nes_mapper.h>
+#include <nes_memory.h>
+#include <nes_ppu.h>
+
+#include <cstring>
+
+//
+// Called when mapper is loaded into memory
+// Useful for mapping the initial banks
+//
+void nes_mapper_cnrom::on_load_ram(nes_memory &mem)
+{
+    _mem = &mem;
+
+    // Fixed PRG ROM just like NROM - 16KB PRG ROM wraps around
+    set_prg_window(0, 0);
+    set_prg_window(1, 1);
+}
+
+//
+// Called when mapper is loaded into PPU
+// Useful for mapping the initial banks
+//
+void nes_mapper_cnrom::on_load_ppu(nes_ppu &ppu)
+{
+    _ppu = &ppu;
+
+    set_chr_window(0, 0);
+}
+
+//
+// Returns various mapper related flags
+//
+void nes_mapper_cnrom::get_info(nes_mapper_info &info)
+{
+    memset(&info, 0, sizeof(info));
+
+    if (_prg_rom_size == 0x4000)
+        info.code_addr = 0xc000;
+    else
+        info.code_addr = 0x8000;
+
+    info.reg_start = 0x8000;
+    info.reg_end = 0xffff;
+
+    info.flags = nes_mapper_flags_has_registers;
+    if (_vertical_mirroring)
+        info.flags = nes_mapper_flags(info.flags | nes_mapper_flags_vertical_mirroring);
+    else
+        info.flags = nes_mapper_flags(info.flags | nes_mapper_flags_horizontal_mirroring);
+}
+
+/*
+Bank select ($8000-$FFFF)
+7  bit  0
+---- ----
+cccc ccCC
+|||| ||||
+++++-++++- Select 8 KB CHR ROM bank for PPU $0000-$1FFF
+CNROM only implements the lowest 2 bits, capping it at 32 KiB CHR. Other boards may implement 4 or more bits
+for larger CHR.
+*/
+void nes_mapper_cnrom::write_reg(uint16_t addr, uint8_t val)
+{
+    set_chr_window(0, val);
+}
@@ -6,18 +6,20 @@
 
 //
 // Called when mapper is loaded into memory
-// Useful when all you need is a one-time memcpy
+// Useful for mapping the initial banks
 //
 void nes_mapper_mmc1::on_load_ram(nes_memory &mem)
 {
-    mem.set_bytes(0x8000, _prg_rom + _prg_rom_size - 0x8000, 0x8000);
-
     _mem = &mem;
+
+    // the last 32KB
+    set_prg_window(0, -2);
+    set_prg_window(1, -1);
 }
 
 //
 // Called when mapper is loaded into PPU
-// Useful when all you need is a one-time memcpy
+// Useful for mapping the initial banks
 //
 void nes_mapper_mmc1::on_load_ppu(nes_ppu &ppu)
 {
@@ -106,25 +108,17 @@ MMC1 can do CHR banking in 4KB chunks. Known carts with CHR RAM have 8 KiB, so t
 */
 void nes_mapper_mmc1::write_chr_bank_0(uint8_t val)
 {
-    uint32_t addr;
-    uint16_t size;
     if (_control & 0x10)
     {
         // 4KB mode
-        addr = (val & 0x1f) << 12;
-        size = 0x1000;
+        set_chr_window(0, val & 0x1f);
     }
     else
     {
         // 8KB mode
-        addr = (val & 0x1e) << 12;
-        size = 0x2000;
+        set_chr_window(0, val & 0x1e);
+        set_chr_window(1, (val & 0x1e) + 1);
     }
-
-    if (_chr_rom_size < addr + size)
-        return;
-
-    _ppu->write_bytes(0x0000, _chr_rom + addr, size);
 }
 
 /*
@@ -137,17 +131,10 @@ CCCCC
 */
 void nes_mapper_mmc1::write_chr_bank_1(uint8_t val)
 {
+    // 4KB mode only
+    // 8KB mode is ignored completely
     if (_control & 0x10)
-    {
-        // 4KB mode only
-        // 8KB mode is ignored completely
-        uint32_t addr = (val & 0x1f) << 12;
-        uint16_t size = 0x1000;
-        if (_chr_rom_size < addr + size)
-            return;
-
-        _ppu->write_bytes(0x1000, _chr_rom + addr, size);
-    }
+        set_chr_window(1, val & 0x1f);
 }
 
 /*
@@ -167,19 +154,20 @@ void nes_mapper_mmc1::write_prg_bank(uint8_t val)
         if (_control & 0x4)
         {
             // fix last bank at $C000 and switch 16KB bank at $8000
-            _mem->set_bytes(0x8000, _prg_rom + (val & 0xf) * 0x4000, 0x4000);
-            _mem->set_bytes(0xc000, _prg_rom + _prg_rom_size - 0x4000, 0x4000);
+            set_prg_window(0, val & 0xf);
+            set_prg_window(1, -1);
         }
         else
         {
             // fix first bank at $8000 and switch 16KB bank at $C000
-            _mem->set_bytes(0x8000, _prg_rom, 0x4000);
-            _mem->set_bytes(0xc000, _prg_rom + (val & 0xf) * 0x4000, 0x4000);
+            set_prg_window(0, 0);
+            set_prg_window(1, val & 0xf);
         }
     }
     else
     {
         // 32KB mode at $8000
-        _mem->set_bytes(0x8000, _prg_rom + (val & 0xe) * 0x4000, 0x8000);
+        set_prg_window(0, val & 0xe);
+        set_prg_window(1, (val & 0xe) + 1);
     }
-}
\ No newline at end of file
+}
@@ -1,28 +1,39 @@
 #include <nes_mapper.h>
 #include <nes_memory.h>
 #include <nes_ppu.h>
+#include <nes_cpu.h>
 
 #include <cstring>
 
 //
 // Called when mapper is loaded into memory
-// Useful when all you need is a one-time memcpy
+// Useful for mapping the initial banks
 //
 void nes_mapper_mmc3::on_load_ram(nes_memory &mem)
 {
-    // $E000~$FFFF is always the last bank
-    mem.set_bytes(0xe000, _prg_rom + _prg_rom_size - 0x2000, 0x2000);
-
     _mem = &mem;
+
+    update_prg_windows();
 }
 
 //
 // Called when mapper is loaded into PPU
-// Useful when all you need is a one-time memcpy
+// Useful for mapping the initial banks
 //
 void nes_mapper_mmc3::on_load_ppu(nes_ppu &ppu)
 {
     _ppu = &ppu;
+
+    update_chr_windows();
+}
+
+//
+// Called when mapper is loaded into system
+// Useful for mappers that raise IRQ
+//
+void nes_mapper_mmc3::on_load_cpu(nes_cpu &cpu)
+{
+    _cpu = &cpu;
 }
 
 //
@@ -101,6 +112,10 @@ four 1 KB banks at $0000-$0FFF)
 void nes_mapper_mmc3::write_bank_select(uint8_t val)
 {
     _bank_select = val;
+
+    // PRG mode and CHR A12 inversion take effect right away
+    update_prg_windows();
+    update_chr_windows();
 }
 
 void nes_mapper_mmc3::write_mirroring(uint8_t val)
@@ -109,119 +124,103 @@ void nes_mapper_mmc3::write_mirroring(uint8_t val)
     _ppu->set_mirroring(nes_mapper_flags(_vertical_mirroring? nes_mapper_flags_vertical_mirroring : nes_mapper_flags_horizontal_mirroring));
 }
 
-/*
-*/
 void nes_mapper_mmc3::write_bank_data(uint8_t val)
 {
-    // CHIP A12 inversion
-    bool inversion = _bank_select & 0x80;
-
     int select = _bank_select & 0x7;
-    bool prg_mode_changed = (_prev_prg_mode != (_bank_select & 0x40));
-    _prev_prg_mode = _bank_select & 0x40;
+    _banks[select] = val;
 
-    if (prg_mode_changed)
+    if (select >= 6)
+        update_prg_windows();
+    else
+        update_chr_windows();
+}
+
+void nes_mapper_mmc3::update_prg_windows()
+{
+    // ignore bit 6 and 7 - MMC3 only has 6 PRG ROM address lines
+    int r6 = _banks[6] & 0x3f;
+    int r7 = _banks[7] & 0x3f;
+
+    // the other of $8000/$C000 is fixed to the second last 8KB bank
+    if (_bank_select & 0x40)
     {
-        // the second last 8KB bank
-        if (_bank_select & 0x40)
-        {
-            _mem->set_bytes(0x8000, _prg_rom + _prg_rom_size - 0x4000, 0x2000);
-        }
-        else
-        {
-            _mem->set_bytes(0xc000, _prg_rom + _prg_rom_size - 0x4000, 0x2000);
-        }
+        set_prg_window(0, -2);
+        set_prg_window(2, r6);
     }
-
-    if (select >= 6)
+    else
     {
-        // ignore bit 6 and 7 - the register is incompleted decoded
-        val &= ~0xb0;
-
-        // 8KB bank
-        uint32_t offset = val << 13;
-        uint32_t addr;
-        uint32_t size = 1 << 13;
-
-        if (select == 6)
-        {
-            if (_bank_select & 0x40)
-                addr = 0xc000;
-            else
-                addr = 0x8000;
-        }
-        else
-        {
-            assert(select == 7);
-            addr = 0xa000;
-        }
+        set_prg_window(0, r6);
+        set_prg_window(2, -2);
+    }
 
-        if (_prg_rom_size < offset + size)
-            return;
+    set_prg_window(1, r7);
 
-        _mem->set_bytes(addr, _prg_rom + offset, size);
+    // $E000~$FFFF is always the last bank
+    set_prg_window(3, -1);
+}
+
+void nes_mapper_mmc3::update_chr_windows()
+{
+    // CHR A12 inversion swaps the 2KB half ($0000~$0FFF) and 1KB half ($1000~$1FFF)
+    int window_2k = (_bank_select & 0x80) ? 4 : 0;
+    int window_1k = (_bank_select & 0x80) ? 0 : 4;
+
+    // R0/R1 ignore bit 0 - as if they are in 2KB banks
+    set_chr_window(window_2k + 0, _banks[0] & 0xfe);
+    set_chr_window(window_2k + 1, _banks[0] | 0x01);
+    set_chr_window(window_2k + 2, _banks[1] & 0xfe);
+    set_chr_window(window_2k + 3, _banks[1] | 0x01);
+
+    for (int i = 0; i < 4; ++i)
+        set_chr_window(window_1k + i, _banks[2 + i]);
+}
+
+/*
+$C001 - clears the counter so that it is reloaded from latch at the next A12 rise
+*/
+void nes_mapper_mmc3::write_irq_reload(uint8_t val)
+{
+    _irq_counter = 0;
+    _irq_reload = true;
+}
+
+/*
+$E000 - disables IRQ and acknowledges any pending one
+*/
+void nes_mapper_mmc3::write_irq_disable(uint8_t val)
+{
+    _irq_enabled = false;
+    _cpu->set_irq_line(false);
+}
+
+//
+// Scanline counter
+// http://wiki.nesdev.com/w/index.php/MMC3#IRQ_Specifics
+//
+void nes_mapper_mmc3::on_a12_rise()
+{
+    if (_irq_counter == 0 || _irq_reload)
+    {
+        _irq_counter = _irq_latch;
+        _irq_reload = false;
     }
     else
     {
-        uint16_t ppu_addr;
-        uint16_t ppu_size;
-        uint32_t offset;
-        switch (select)
-        {
-        case 0:
-            // 2KB $0000-$07FF
-            ppu_addr = 0;
-            ppu_size = 0x800;
-
-            // ignore bit 0 - as if this is 2KB mode
-            val &= ~0x1;
-            break;
-
-        case 1:
-            // 2KB $0800~$0FFF
-            ppu_addr = 0x800;
-            ppu_size = 0x800;
-
-            // ignore bit 0 - as if this is like 2KB mode
-            val &= ~0x1;
-            break;
-
-        case 2:
-            // 1KB $1000~$13FF
-            ppu_addr = 0x1000;
-            ppu_size = 0x400;
-            break;
-
-        case 3:
-            // 1KB $1400~$17FF
-            ppu_addr = 0x1400;
-            ppu_size = 0x400;
-
-            break;
-        case 4:
-            // 1KB $1800~$1BFF
-            ppu_addr = 0x1800;
-            ppu_size = 0x400;
-            break;
-
-        case 5:
-            // 1KB $1C00~$1FFF
-            ppu_addr = 0x1c00;
-            ppu_size = 0x400;
-            break;
-
-        default:
-            assert(false);
-        }
-
-        offset = uint32_t(val) << 10;
-        if (inversion)
-            ppu_addr ^= 0x1000;
-
-        if (_chr_rom_size < offset + ppu_size)
-            return;
-
-        _ppu->write_bytes(ppu_addr, _chr_rom + offset, ppu_size);
+        _irq_counter--;
     }
+
+    if (_irq_counter == 0 && _irq_enabled)
+        _cpu->set_irq_line(true);
 }
 
+int nes_mapper_mmc3::a12_rises_until_irq()
+{
+    if (!_irq_enabled)
+        return -1;
+
+    // Reloading takes one rise - and latch 0 keeps firing on every rise after that
+    if (_irq_counter == 0 || _irq_reload)
+        return _irq_latch == 0 ? 1 : _irq_latch + 1;
+
+    return _irq_counter;
+}
@@ -6,28 +6,26 @@
 
 //
 // Called when mapper is loaded into memory
-// Useful when all you need is a one-time memcpy
+// Useful for mapping the initial banks
 //
 void nes_mapper_nrom::on_load_ram(nes_memory &mem)
 {
-    // memcpy
-    mem.set_bytes(0x8000, _prg_rom, _prg_rom_size);
+    _mem = &mem;
 
-    if (_prg_rom_size == 0x4000)
-    {
-        // "map" 0xC000 to 0x8000
-        mem.set_bytes(0xc000, _prg_rom, _prg_rom_size);
-    }
+    // 16KB PRG ROM wraps around - $C000 mirrors $8000
+    set_prg_window(0, 0);
+    set_prg_window(1, 1);
 }
 
 //
 // Called when mapper is loaded into PPU
-// Useful when all you need is a one-time memcpy
+// Useful for mapping the initial banks
 //
 void nes_mapper_nrom::on_load_ppu(nes_ppu &ppu)
 {
-    // memcpy
-    ppu.write_bytes(0x0000, _chr_rom, _chr_rom_size);
+    _ppu = &ppu;
+
+    set_chr_window(0, 0);
 }
 
 //
@@ -0,0 +1,63 @@
+#include <nes_mapper.h>
+#include <nes_memory.h>
+#include <nes_ppu.h>
+
+#include <cstring>
+
+//
+// Called when mapper is loaded into memory
+// Useful for mapping the initial banks
+//
+void nes_mapper_uxrom::on_load_ram(nes_memory &mem)
+{
+    _mem = &mem;
+
+    // $C000~$FFFF is always the last bank
+    set_prg_window(0, 0);
+    set_prg_window(1, -1);
+}
+
+//
+// Called when mapper is loaded into PPU
+// Useful for mapping the initial banks
+//
+void nes_mapper_uxrom::on_load_ppu(nes_ppu &ppu)
+{
+    _ppu = &ppu;
+
+    // UxROM boards have CHR RAM - but map CHR ROM if there is any
+    set_chr_window(0, 0);
+}
+
+//
+// Returns various mapper related flags
+//
+void nes_mapper_uxrom::get_info(nes_mapper_info &info)
+{
+    memset(&info, 0, sizeof(info));
+
+    info.code_addr = 0x8000;
+
+    info.reg_start = 0x8000;
+    info.reg_end = 0xffff;
+
+    info.flags = nes_mapper_flags_has_registers;
+    if (_vertical_mirroring)
+        info.flags = nes_mapper_flags(info.flags | nes_mapper_flags_vertical_mirroring);
+    else
+        info.flags = nes_mapper_flags(info.flags | nes_mapper_flags_horizontal_mirroring);
+}
+
+/*
+Bank select ($8000-$FFFF)
+7  bit  0
+---- ----
+xxxx pPPP
+     ||||
+     ++++- Select 16 KB PRG ROM bank for CPU $8000-$BFFF
+          (UNROM uses bits 2-0; UOROM uses 3-0)
+*/
+void nes_mapper_uxrom::write_reg(uint16_t addr, uint8_t val)
+{
+    set_prg_window(0, val & 0xf);
+}
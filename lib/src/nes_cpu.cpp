@@ -3,6 +3,9 @@
 #include "nes_system.h"
 #include "nes_trace.h"
 
+#include <algorithm>
+#include <iomanip>
+
 void nes_cpu::power_on(nes_system *system)
 {
     _system = system;
@@ -11,13 +14,24 @@ void nes_cpu::power_on(nes_system *system)
     _cycle = nes_cycle_t(0);
     _nmi_pending = false;
     _dma_pending = false;
+    _irq_line = false;
+    _operand_prefetched = false;
+    _detect_idle_loop = false;
+    _idle_loop.head = 0;
+    _idle_loop.cycle = nes_cycle_t(-1);
+
+    // generation 0 is never used by nes_memory so the slots get looked up on first use
+    _decoded_banks.clear();
+    memset(_decoded_slots, 0, sizeof(_decoded_slots));
+    _decoded_prg_generation = 0;
+    _decoded_prg_rom_generation = 0;
 
     _is_stop_at_addr = false;
     _stop_at_infinite_loop = false;
 
     // @TODO - Simulate full power-on state
     // http://wiki.nesdev.com/w/index.php/CPU_power_up_state
-    _context.P = 0x24;          // @TODO - Should be 0x34 - but temporarily set to 0x24 to match nintendulator baseline
+    set_P(0x24);                // @TODO - Should be 0x34 - but temporarily set to 0x24 to match nintendulator baseline
     _context.A = _context.X = _context.Y = 0;
     _context.S = 0xfd;
     _context.PC = 0;
@@ -35,44 +49,436 @@ void nes_cpu::poke(uint16_t addr, uint8_t value)
 
 void nes_cpu::step_to(nes_cycle_t new_count)
 {
+    // Pick the core once per call rather than checking the tracer / profiler for every instruction
+    if (NES_TRACE_IS_ENABLED(nes_tracer_level_diag) || _profile)
+        run_to<true>(new_count);
+    else
+        run_to<false>(new_count);
+}
+
+template<bool instrumented>
+void nes_cpu::run_to(nes_cycle_t new_count)
+{
+    _run_to_cycle = new_count;
+    _detect_idle_loop = !instrumented;
+
     // we are asked to proceed to new_count - keep executing one instruction
-    while (_cycle < new_count && !_system->stop_requested())
-        exec_one_instruction();
-}
-
-#define IS_ALU_OP_CODE_(op, offset, mode) case nes_op_code::op##_base + offset : NES_TRACE4(get_op_str(#op, nes_addr_mode::nes_addr_mode_##mode)); op(nes_addr_mode::nes_addr_mode_##mode); break;
-#define IS_ALU_OP_CODE(op) \
-    IS_ALU_OP_CODE_(op, 0x9, imm) \
-    IS_ALU_OP_CODE_(op, 0x5, zp) \
-    IS_ALU_OP_CODE_(op, 0x15, zp_ind_x) \
-    IS_ALU_OP_CODE_(op, 0xd, abs) \
-    IS_ALU_OP_CODE_(op, 0x1d, abs_x) \
-    IS_ALU_OP_CODE_(op, 0x19, abs_y) \
-    IS_ALU_OP_CODE_(op, 0x1, ind_x) \
-    IS_ALU_OP_CODE_(op, 0x11, ind_y)
-
-#define IS_ALU_OP_CODE_NO_IMM(op) \
-    IS_ALU_OP_CODE_(op, 0x5, zp) \
-    IS_ALU_OP_CODE_(op, 0x15, zp_ind_x) \
-    IS_ALU_OP_CODE_(op, 0xd, abs) \
-    IS_ALU_OP_CODE_(op, 0x1d, abs_x) \
-    IS_ALU_OP_CODE_(op, 0x19, abs_y) \
-    IS_ALU_OP_CODE_(op, 0x1, ind_x) \
-    IS_ALU_OP_CODE_(op, 0x11, ind_y)
-
-#define IS_RMW_OP_CODE_(op, opcode, offset, mode) case opcode + offset : NES_TRACE4(get_op_str(#op, nes_addr_mode::nes_addr_mode_##mode)); op(nes_addr_mode::nes_addr_mode_##mode); break;
-#define IS_RMW_OP_CODE(op, opcode) \
-    IS_RMW_OP_CODE_(op, opcode, 0x6, zp) \
-    IS_RMW_OP_CODE_(op, opcode, 0xa, acc) \
-    IS_RMW_OP_CODE_(op, opcode, 0x16, zp_ind_x) \
-    IS_RMW_OP_CODE_(op, opcode, 0xe, abs) \
-    IS_RMW_OP_CODE_(op, opcode, 0x1e, abs_x)
-
-#define IS_OP_CODE(op, opcode) case opcode : NES_TRACE4(get_op_str(#op, nes_addr_mode_imp)); op(nes_addr_mode_imp); break;
-#define IS_OP_CODE_MODE(op, opcode, mode) case opcode : NES_TRACE4(get_op_str(#op, nes_addr_mode_##mode)); op(nes_addr_mode_##mode); break;
-
-#define IS_UNOFFICIAL_OP_CODE(op, opcode) case opcode : NES_TRACE4(get_op_str(#op, nes_addr_mode_imp, false)); op(nes_addr_mode_imp); break;
-#define IS_UNOFFICIAL_OP_CODE_MODE(op, opcode, mode) case opcode : NES_TRACE4(get_op_str(#op, nes_addr_mode_##mode, false)); op(nes_addr_mode_##mode); break;
+    // _run_to_cycle can be moved earlier while running - see shorten_run_to
+    while (_cycle < _run_to_cycle && !_system->stop_requested())
+        exec_one_instruction<instrumented>();
+}
+
+void nes_cpu::enable_profiler(bool enable)
+{
+    if (enable)
+    {
+        if (!_profile)
+            _profile = make_unique<nes_cpu_profile>();
+        reset_profiler();
+    }
+    else
+    {
+        _profile = nullptr;
+    }
+}
+
+void nes_cpu::reset_profiler()
+{
+    if (_profile)
+        memset(_profile.get(), 0, sizeof(nes_cpu_profile));
+}
+
+void nes_cpu::profile_op(uint16_t pc, nes_cycle_t start_cycle)
+{
+    uint64_t cycles = duration_cast<nes_cpu_cycle_t>(_cycle - start_cycle).count();
+
+    nes_cpu_profile_counter &op_counter = _profile->op_codes[_op_code];
+    op_counter.count++;
+    op_counter.cycles += cycles;
+
+    nes_cpu_profile_counter &pc_counter = _profile->pcs[pc];
+    pc_counter.count++;
+    pc_counter.cycles += cycles;
+
+    if (pc >= PRG_ROM_START)
+    {
+        nes_cpu_profile_counter &bank_counter = _profile->prg_banks[_mem->prg_bank(pc) % PROFILE_PRG_BANK_COUNT];
+        bank_counter.count++;
+        bank_counter.cycles += cycles;
+    }
+}
+
+//
+// Dump top_count entries of each counter array, hottest first, such as:
+//
+// PCs
+//    PC       count        cycles      %
+//  $C5F5      123456        370368  12.34
+//
+void nes_cpu::dump_profile(ostream &os, size_t top_count)
+{
+    if (!_profile)
+        return;
+
+    uint64_t total_cycles = 0;
+    for (auto &counter : _profile->op_codes)
+        total_cycles += counter.cycles;
+
+    auto dump = [&](const char *title, const char *key_name, const nes_cpu_profile_counter *counters, size_t size, auto dump_key) {
+        vector<size_t> keys;
+        for (size_t i = 0; i < size; ++i)
+        {
+            if (counters[i].count)
+                keys.push_back(i);
+        }
+
+        sort(keys.begin(), keys.end(), [&](size_t a, size_t b) {
+            if (counters[a].cycles != counters[b].cycles)
+                return counters[a].cycles > counters[b].cycles;
+            return a < b;
+        });
+
+        if (keys.size() > top_count)
+            keys.resize(top_count);
+
+        os << title << endl;
+        os << setw(10) << key_name << setw(14) << "count" << setw(14) << "cycles" << setw(8) << "%" << endl;
+        for (auto key : keys)
+        {
+            dump_key(key);
+            os << setw(14) << counters[key].count << setw(14) << counters[key].cycles;
+            os << setw(8) << fixed << setprecision(2) << (total_cycles ? counters[key].cycles * 100.0 / total_cycles : 0.0);
+            os << endl;
+        }
+        os << endl;
+    };
+
+    ios_base::fmtflags flags = os.flags();
+
+    dump("Op codes", "op", _profile->op_codes, 0x100, [&](size_t key) {
+        os << "  " << hex << setfill('0') << setw(2) << key << dec << setfill(' ') << ' ' << setw(5) << left << s_op_table[key].name << right;
+    });
+    dump("PCs", "PC", _profile->pcs, RAM_SIZE, [&](size_t key) {
+        os << "     $" << hex << uppercase << setfill('0') << setw(4) << key << dec << nouppercase << setfill(' ');
+    });
+    dump("PRG banks (8KB)", "bank", _profile->prg_banks, PROFILE_PRG_BANK_COUNT, [&](size_t key) {
+        os << setw(10) << key;
+    });
+
+    os.flags(flags);
+}
+
+//
+// The one op code table that everything else is generated from: dispatch (s_op_table), cycles, page crossing
+// penalty, and instruction length (used by disassembly in get_op_str)
+//
+// OP(op code, instruction, addressing mode, base cycles, +1 cycle when crossing page, is official)
+//
+// Note that some instructions always take the page crossing penalty (STA abs_x, RMW unofficial op codes, etc) -
+// it's simply part of their base cycles
+// Branches take their extra cycles from get_branch_cycle
+//
+#define NES_OP_CODE_TABLE(OP) \
+    OP(0x00, BRK, imp,      7, 0, true  ) \
+    OP(0x01, ORA, ind_x,    6, 0, true  ) \
+    OP(0x02, KIL, imp,      0, 0, true  ) \
+    OP(0x03, SLO, ind_x,    8, 0, false ) \
+    OP(0x04, NOP, zp,       3, 0, false ) \
+    OP(0x05, ORA, zp,       3, 0, true  ) \
+    OP(0x06, ASL, zp,       5, 0, true  ) \
+    OP(0x07, SLO, zp,       5, 0, false ) \
+    OP(0x08, PHP, imp,      3, 0, true  ) \
+    OP(0x09, ORA, imm,      2, 0, true  ) \
+    OP(0x0a, ASL, acc,      2, 0, true  ) \
+    OP(0x0b, ANC, imm,      2, 0, false ) \
+    OP(0x0c, NOP, abs,      4, 0, false ) \
+    OP(0x0d, ORA, abs,      4, 0, true  ) \
+    OP(0x0e, ASL, abs,      6, 0, true  ) \
+    OP(0x0f, SLO, abs,      6, 0, false ) \
+    OP(0x10, BPL, rel,      2, 0, true  ) \
+    OP(0x11, ORA, ind_y,    5, 1, true  ) \
+    OP(0x12, KIL, imp,      0, 0, true  ) \
+    OP(0x13, SLO, ind_y,    8, 0, false ) \
+    OP(0x14, NOP, zp_ind_x, 4, 0, false ) \
+    OP(0x15, ORA, zp_ind_x, 4, 0, true  ) \
+    OP(0x16, ASL, zp_ind_x, 6, 0, true  ) \
+    OP(0x17, SLO, zp_ind_x, 6, 0, false ) \
+    OP(0x18, CLC, imp,      2, 0, true  ) \
+    OP(0x19, ORA, abs_y,    4, 1, true  ) \
+    OP(0x1a, NOP, imp,      2, 0, false ) \
+    OP(0x1b, SLO, abs_y,    7, 0, false ) \
+    OP(0x1c, NOP, abs_x,    4, 1, false ) \
+    OP(0x1d, ORA, abs_x,    4, 1, true  ) \
+    OP(0x1e, ASL, abs_x,    7, 0, true  ) \
+    OP(0x1f, SLO, abs_x,    7, 0, false ) \
+    OP(0x20, JSR, abs_jmp,  6, 0, true  ) \
+    OP(0x21, AND, ind_x,    6, 0, true  ) \
+    OP(0x22, KIL, imp,      0, 0, true  ) \
+    OP(0x23, RLA, ind_x,    8, 0, false ) \
+    OP(0x24, BIT, zp,       3, 0, true  ) \
+    OP(0x25, AND, zp,       3, 0, true  ) \
+    OP(0x26, ROL, zp,       5, 0, true  ) \
+    OP(0x27, RLA, zp,       5, 0, false ) \
+    OP(0x28, PLP, imp,      4, 0, true  ) \
+    OP(0x29, AND, imm,      2, 0, true  ) \
+    OP(0x2a, ROL, acc,      2, 0, true  ) \
+    OP(0x2b, ANC, imm,      2, 0, false ) \
+    OP(0x2c, BIT, abs,      4, 0, true  ) \
+    OP(0x2d, AND, abs,      4, 0, true  ) \
+    OP(0x2e, ROL, abs,      6, 0, true  ) \
+    OP(0x2f, RLA, abs,      6, 0, false ) \
+    OP(0x30, BMI, rel,      2, 0, true  ) \
+    OP(0x31, AND, ind_y,    5, 1, true  ) \
+    OP(0x32, KIL, imp,      0, 0, true  ) \
+    OP(0x33, RLA, ind_y,    8, 0, false ) \
+    OP(0x34, NOP, zp_ind_x, 4, 0, false ) \
+    OP(0x35, AND, zp_ind_x, 4, 0, true  ) \
+    OP(0x36, ROL, zp_ind_x, 6, 0, true  ) \
+    OP(0x37, RLA, zp_ind_x, 6, 0, false ) \
+    OP(0x38, SEC, imp,      2, 0, true  ) \
+    OP(0x39, AND, abs_y,    4, 1, true  ) \
+    OP(0x3a, NOP, imp,      2, 0, false ) \
+    OP(0x3b, RLA, abs_y,    7, 0, false ) \
+    OP(0x3c, NOP, abs_x,    4, 1, false ) \
+    OP(0x3d, AND, abs_x,    4, 1, true  ) \
+    OP(0x3e, ROL, abs_x,    7, 0, true  ) \
+    OP(0x3f, RLA, abs_x,    7, 0, false ) \
+    OP(0x40, RTI, imp,      6, 0, true  ) \
+    OP(0x41, EOR, ind_x,    6, 0, true  ) \
+    OP(0x42, KIL, imp,      0, 0, true  ) \
+    OP(0x43, SRE, ind_x,    8, 0, false ) \
+    OP(0x44, NOP, zp,       3, 0, false ) \
+    OP(0x45, EOR, zp,       3, 0, true  ) \
+    OP(0x46, LSR, zp,       5, 0, true  ) \
+    OP(0x47, SRE, zp,       5, 0, false ) \
+    OP(0x48, PHA, imp,      3, 0, true  ) \
+    OP(0x49, EOR, imm,      2, 0, true  ) \
+    OP(0x4a, LSR, acc,      2, 0, true  ) \
+    OP(0x4b, ALR, imm,      2, 0, false ) \
+    OP(0x4c, JMP, abs_jmp,  3, 0, true  ) \
+    OP(0x4d, EOR, abs,      4, 0, true  ) \
+    OP(0x4e, LSR, abs,      6, 0, true  ) \
+    OP(0x4f, SRE, abs,      6, 0, false ) \
+    OP(0x50, BVC, rel,      2, 0, true  ) \
+    OP(0x51, EOR, ind_y,    5, 1, true  ) \
+    OP(0x52, KIL, imp,      0, 0, true  ) \
+    OP(0x53, SRE, ind_y,    8, 0, false ) \
+    OP(0x54, NOP, zp_ind_x, 4, 0, false ) \
+    OP(0x55, EOR, zp_ind_x, 4, 0, true  ) \
+    OP(0x56, LSR, zp_ind_x, 6, 0, true  ) \
+    OP(0x57, SRE, zp_ind_x, 6, 0, false ) \
+    OP(0x58, CLI, imp,      2, 0, true  ) \
+    OP(0x59, EOR, abs_y,    4, 1, true  ) \
+    OP(0x5a, NOP, imp,      2, 0, false ) \
+    OP(0x5b, SRE, abs_y,    7, 0, false ) \
+    OP(0x5c, NOP, abs_x,    4, 1, false ) \
+    OP(0x5d, EOR, abs_x,    4, 1, true  ) \
+    OP(0x5e, LSR, abs_x,    7, 0, true  ) \
+    OP(0x5f, SRE, abs_x,    7, 0, false ) \
+    OP(0x60, RTS, imp,      6, 0, true  ) \
+    OP(0x61, ADC, ind_x,    6, 0, true  ) \
+    OP(0x62, KIL, imp,      0, 0, true  ) \
+    OP(0x63, RRA, ind_x,    8, 0, false ) \
+    OP(0x64, NOP, zp,       3, 0, false ) \
+    OP(0x65, ADC, zp,       3, 0, true  ) \
+    OP(0x66, ROR, zp,       5, 0, true  ) \
+    OP(0x67, RRA, zp,       5, 0, false ) \
+    OP(0x68, PLA, imp,      4, 0, true  ) \
+    OP(0x69, ADC, imm,      2, 0, true  ) \
+    OP(0x6a, ROR, acc,      2, 0, true  ) \
+    OP(0x6b, ARR, imm,      2, 0, false ) \
+    OP(0x6c, JMP, ind_jmp,  5, 0, true  ) \
+    OP(0x6d, ADC, abs,      4, 0, true  ) \
+    OP(0x6e, ROR, abs,      6, 0, true  ) \
+    OP(0x6f, RRA, abs,      6, 0, false ) \
+    OP(0x70, BVS, rel,      2, 0, true  ) \
+    OP(0x71, ADC, ind_y,    5, 1, true  ) \
+    OP(0x72, KIL, imp,      0, 0, true  ) \
+    OP(0x73, RRA, ind_y,    8, 0, false ) \
+    OP(0x74, NOP, zp_ind_x, 4, 0, false ) \
+    OP(0x75, ADC, zp_ind_x, 4, 0, true  ) \
+    OP(0x76, ROR, zp_ind_x, 6, 0, true  ) \
+    OP(0x77, RRA, zp_ind_x, 6, 0, false ) \
+    OP(0x78, SEI, imp,      2, 0, true  ) \
+    OP(0x79, ADC, abs_y,    4, 1, true  ) \
+    OP(0x7a, NOP, imp,      2, 0, false ) \
+    OP(0x7b, RRA, abs_y,    7, 0, false ) \
+    OP(0x7c, NOP, abs_x,    4, 1, false ) \
+    OP(0x7d, ADC, abs_x,    4, 1, true  ) \
+    OP(0x7e, ROR, abs_x,    7, 0, true  ) \
+    OP(0x7f, RRA, abs_x,    7, 0, false ) \
+    OP(0x80, NOP, imm,      2, 0, false ) \
+    OP(0x81, STA, ind_x,    6, 0, true  ) \
+    OP(0x82, NOP, imm,      2, 0, false ) \
+    OP(0x83, SAX, ind_x,    6, 0, false ) \
+    OP(0x84, STY, zp,       3, 0, true  ) \
+    OP(0x85, STA, zp,       3, 0, true  ) \
+    OP(0x86, STX, zp,       3, 0, true  ) \
+    OP(0x87, SAX, zp,       3, 0, false ) \
+    OP(0x88, DEY, imp,      2, 0, true  ) \
+    OP(0x89, NOP, imm,      2, 0, false ) \
+    OP(0x8a, TXA, imp,      2, 0, true  ) \
+    OP(0x8b, XAA, imm,      2, 0, false ) \
+    OP(0x8c, STY, abs,      4, 0, true  ) \
+    OP(0x8d, STA, abs,      4, 0, true  ) \
+    OP(0x8e, STX, abs,      4, 0, true  ) \
+    OP(0x8f, SAX, abs,      4, 0, false ) \
+    OP(0x90, BCC, rel,      2, 0, true  ) \
+    OP(0x91, STA, ind_y,    6, 0, true  ) \
+    OP(0x92, KIL, imp,      0, 0, true  ) \
+    OP(0x93, AHX, ind_y,    6, 0, false ) \
+    OP(0x94, STY, zp_ind_x, 4, 0, true  ) \
+    OP(0x95, STA, zp_ind_x, 4, 0, true  ) \
+    OP(0x96, STX, zp_ind_y, 4, 0, true  ) \
+    OP(0x97, SAX, zp_ind_y, 4, 0, false ) \
+    OP(0x98, TYA, imp,      2, 0, true  ) \
+    OP(0x99, STA, abs_y,    5, 0, true  ) \
+    OP(0x9a, TXS, imp,      2, 0, true  ) \
+    OP(0x9b, TAS, abs_y,    5, 0, false ) \
+    OP(0x9c, ILL, imp,      0, 0, false ) \
+    OP(0x9d, STA, abs_x,    5, 0, true  ) \
+    OP(0x9e, ILL, imp,      0, 0, false ) \
+    OP(0x9f, AHX, abs_y,    5, 0, false ) \
+    OP(0xa0, LDY, imm,      2, 0, true  ) \
+    OP(0xa1, LDA, ind_x,    6, 0, true  ) \
+    OP(0xa2, LDX, imm,      2, 0, true  ) \
+    OP(0xa3, LAX, ind_x,    6, 0, false ) \
+    OP(0xa4, LDY, zp,       3, 0, true  ) \
+    OP(0xa5, LDA, zp,       3, 0, true  ) \
+    OP(0xa6, LDX, zp,       3, 0, true  ) \
+    OP(0xa7, LAX, zp,       3, 0, false ) \
+    OP(0xa8, TAY, imp,      2, 0, true  ) \
+    OP(0xa9, LDA, imm,      2, 0, true  ) \
+    OP(0xaa, TAX, imp,      2, 0, true  ) \
+    OP(0xab, LAX, imm,      2, 0, false ) \
+    OP(0xac, LDY, abs,      4, 0, true  ) \
+    OP(0xad, LDA, abs,      4, 0, true  ) \
+    OP(0xae, LDX, abs,      4, 0, true  ) \
+    OP(0xaf, LAX, abs,      4, 0, false ) \
+    OP(0xb0, BCS, rel,      2, 0, true  ) \
+    OP(0xb1, LDA, ind_y,    5, 1, true  ) \
+    OP(0xb2, KIL, imp,      0, 0, true  ) \
+    OP(0xb3, LAX, ind_y,    5, 1, false ) \
+    OP(0xb4, LDY, zp_ind_x, 4, 0, true  ) \
+    OP(0xb5, LDA, zp_ind_x, 4, 0, true  ) \
+    OP(0xb6, LDX, zp_ind_y, 4, 0, true  ) \
+    OP(0xb7, LAX, zp_ind_y, 4, 0, false ) \
+    OP(0xb8, CLV, imp,      2, 0, true  ) \
+    OP(0xb9, LDA, abs_y,    4, 1, true  ) \
+    OP(0xba, TSX, imp,      2, 0, true  ) \
+    OP(0xbb, LAS, zp_ind_y, 4, 1, false ) \
+    OP(0xbc, LDY, abs_x,    4, 1, true  ) \
+    OP(0xbd, LDA, abs_x,    4, 1, true  ) \
+    OP(0xbe, LDX, abs_y,    4, 1, true  ) \
+    OP(0xbf, LAX, abs_y,    4, 1, false ) \
+    OP(0xc0, CPY, imm,      2, 0, true  ) \
+    OP(0xc1, CMP, ind_x,    6, 0, true  ) \
+    OP(0xc2, NOP, imm,      2, 0, false ) \
+    OP(0xc3, DCP, ind_x,    8, 0, false ) \
+    OP(0xc4, CPY, zp,       3, 0, true  ) \
+    OP(0xc5, CMP, zp,       3, 0, true  ) \
+    OP(0xc6, DEC, zp,       5, 0, true  ) \
+    OP(0xc7, DCP, zp,       5, 0, false ) \
+    OP(0xc8, INY, imp,      2, 0, true  ) \
+    OP(0xc9, CMP, imm,      2, 0, true  ) \
+    OP(0xca, DEX, imp,      2, 0, true  ) \
+    OP(0xcb, AXS, imm,      2, 0, false ) \
+    OP(0xcc, CPY, abs,      4, 0, true  ) \
+    OP(0xcd, CMP, abs,      4, 0, true  ) \
+    OP(0xce, DEC, abs,      6, 0, true  ) \
+    OP(0xcf, DCP, abs,      6, 0, false ) \
+    OP(0xd0, BNE, rel,      2, 0, true  ) \
+    OP(0xd1, CMP, ind_y,    5, 1, true  ) \
+    OP(0xd2, KIL, imp,      0, 0, true  ) \
+    OP(0xd3, DCP, ind_y,    8, 0, false ) \
+    OP(0xd4, NOP, zp_ind_x, 4, 0, false ) \
+    OP(0xd5, CMP, zp_ind_x, 4, 0, true  ) \
+    OP(0xd6, DEC, zp_ind_x, 6, 0, true  ) \
+    OP(0xd7, DCP, zp_ind_x, 6, 0, false ) \
+    OP(0xd8, CLD, imp,      2, 0, true  ) \
+    OP(0xd9, CMP, abs_y,    4, 1, true  ) \
+    OP(0xda, NOP, imp,      2, 0, false ) \
+    OP(0xdb, DCP, abs_y,    7, 0, false ) \
+    OP(0xdc, NOP, abs_x,    4, 1, false ) \
+    OP(0xdd, CMP, abs_x,    4, 1, true  ) \
+    OP(0xde, DEC, abs_x,    7, 0, true  ) \
+    OP(0xdf, DCP, abs_x,    7, 0, false ) \
+    OP(0xe0, CPX, imm,      2, 0, true  ) \
+    OP(0xe1, SBC, ind_x,    6, 0, true  ) \
+    OP(0xe2, NOP, imm,      2, 0, false ) \
+    OP(0xe3, ISC, ind_x,    8, 0, false ) \
+    OP(0xe4, CPX, zp,       3, 0, true  ) \
+    OP(0xe5, SBC, zp,       3, 0, true  ) \
+    OP(0xe6, INC, zp,       5, 0, true  ) \
+    OP(0xe7, ISC, zp,       5, 0, false ) \
+    OP(0xe8, INX, imp,      2, 0, true  ) \
+    OP(0xe9, SBC, imm,      2, 0, true  ) \
+    OP(0xea, NOP, imp,      2, 0, true  ) \
+    OP(0xeb, SBC, imm,      2, 0, false ) \
+    OP(0xec, CPX, abs,      4, 0, true  ) \
+    OP(0xed, SBC, abs,      4, 0, true  ) \
+    OP(0xee, INC, abs,      6, 0, true  ) \
+    OP(0xef, ISC, abs,      6, 0, false ) \
+    OP(0xf0, BEQ, rel,      2, 0, true  ) \
+    OP(0xf1, SBC, ind_y,    5, 1, true  ) \
+    OP(0xf2, KIL, imp,      0, 0, true  ) \
+    OP(0xf3, ISC, ind_y,    8, 0, false ) \
+    OP(0xf4, NOP, zp_ind_x, 4, 0, false ) \
+    OP(0xf5, SBC, zp_ind_x, 4, 0, true  ) \
+    OP(0xf6, INC, zp_ind_x, 6, 0, true  ) \
+    OP(0xf7, ISC, zp_ind_x, 6, 0, false ) \
+    OP(0xf8, SED, imp,      2, 0, true  ) \
+    OP(0xf9, SBC, abs_y,    4, 1, true  ) \
+    OP(0xfa, NOP, imp,      2, 0, false ) \
+    OP(0xfb, ISC, abs_y,    7, 0, false ) \
+    OP(0xfc, NOP, abs_x,    4, 1, false ) \
+    OP(0xfd, SBC, abs_x,    4, 1, true  ) \
+    OP(0xfe, INC, abs_x,    7, 0, true  ) \
+    OP(0xff, ISC, abs_x,    7, 0, false )
+
+#define OP_CODE_(op_code, op, mode, cycles, page_cross, official) op_code,
+#define OP_CYCLES_(op_code, op, mode, cycles, page_cross, official) cycles,
+#define OP_PAGE_CROSS_(op_code, op, mode, cycles, page_cross, official) page_cross,
+#define OP_LENGTH_(op_code, op, mode, cycles, page_cross, official) get_op_length(nes_addr_mode::nes_addr_mode_##mode),
+
+static constexpr uint8_t get_op_length(nes_addr_mode addr_mode)
+{
+    switch (addr_mode)
+    {
+    case nes_addr_mode::nes_addr_mode_imp:
+    case nes_addr_mode::nes_addr_mode_acc:
+        return 1;
+
+    case nes_addr_mode::nes_addr_mode_ind_jmp:
+    case nes_addr_mode::nes_addr_mode_abs:
+    case nes_addr_mode::nes_addr_mode_abs_jmp:
+    case nes_addr_mode::nes_addr_mode_abs_x:
+    case nes_addr_mode::nes_addr_mode_abs_y:
+        return 3;
+
+    default:
+        return 2;
+    }
+}
+
+static constexpr uint8_t s_op_codes[] = { NES_OP_CODE_TABLE(OP_CODE_) };
+static constexpr uint8_t s_op_cycles[] = { NES_OP_CODE_TABLE(OP_CYCLES_) };
+static constexpr uint8_t s_op_page_cross[] = { NES_OP_CODE_TABLE(OP_PAGE_CROSS_) };
+static constexpr uint8_t s_op_length[] = { NES_OP_CODE_TABLE(OP_LENGTH_) };
+
+static constexpr bool is_op_code_table_in_order()
+{
+    for (int i = 0; i < 0x100; ++i)
+    {
+        if (s_op_codes[i] != i)
+            return false;
+    }
+
+    return true;
+}
+
+static_assert(sizeof(s_op_codes) == 0x100, "NES_OP_CODE_TABLE needs exactly one entry per op code");
+static_assert(is_op_code_table_in_order(), "NES_OP_CODE_TABLE needs to be ordered by op code");
 
 void nes_cpu::NMI()
 {
@@ -87,10 +493,24 @@ void nes_cpu::NMI()
     PC() = peek_word(NMI_HANDLER);
 }
 
+void nes_cpu::IRQ()
+{
+    NES_TRACE3("[NES_CPU] IRQ interrupt");
+
+    // Same as NMI, except that IRQ is masked by I so it needs to set I to avoid interrupting itself
+    push_word(PC());
+    push_byte(P() | 0x20);
+    set_interrupt_flag(true);
+
+    step_cpu(7);
+    PC() = peek_word(IRQ_HANDLER);
+}
+
 void nes_cpu::OAMDMA()
 {
     NES_TRACE3("[NES_CPU] OAMDMA at " << _dma_addr);
 
+    _system->sync_ppu();
     _system->ppu()->oam_dma(_dma_addr);
 
     // The entire DMA takes 513 or 514 cycles
@@ -101,6 +521,7 @@ void nes_cpu::OAMDMA()
         step_cpu(513);
 }
 
+template<bool instrumented>
 void nes_cpu::exec_one_instruction()
 {
     if (_is_stop_at_addr && _stop_at_addr == PC())
@@ -122,245 +543,147 @@ void nes_cpu::exec_one_instruction()
 
         _dma_pending = false;
     }
+    else if (_irq_line && !is_interrupt())
+    {
+        IRQ();
+    }
     else
     {
         // next op
-        auto op_code = decode_byte();
+        uint16_t pc = _context.PC;
+        _op_code = decode_op();
 
-        // Let's start with a switch / case
-        // Compiler should do good enough job to create a jump table
-        // The problem with starting with my own table is that it get massive with lots of empty entries before I code
-        // up any instructions.
-        switch (op_code)
+        if (instrumented)
         {
-        IS_ALU_OP_CODE(ADC)
-        IS_ALU_OP_CODE(AND)
-        IS_ALU_OP_CODE(CMP)
-        IS_ALU_OP_CODE(EOR)
-        IS_ALU_OP_CODE(ORA)
-        IS_ALU_OP_CODE(SBC)
-        IS_ALU_OP_CODE_NO_IMM(STA)
-        IS_ALU_OP_CODE(LDA)
-
-        IS_RMW_OP_CODE(ASL, 0x0)
-        IS_RMW_OP_CODE(ROL, 0x20)
-        IS_RMW_OP_CODE(LSR, 0x40)
-        IS_RMW_OP_CODE(ROR, 0x60)
-
-        IS_OP_CODE_MODE(LDX, 0xa2, imm)
-        IS_OP_CODE_MODE(LDX, 0xa6, zp)
-        IS_OP_CODE_MODE(LDX, 0xb6, zp_ind_y)
-        IS_OP_CODE_MODE(LDX, 0xae, abs)
-        IS_OP_CODE_MODE(LDX, 0xbe, abs_y)
-        IS_OP_CODE_MODE(LDY, 0xa0, imm)
-        IS_OP_CODE_MODE(LDY, 0xa4, zp)
-        IS_OP_CODE_MODE(LDY, 0xb4, zp_ind_x)
-        IS_OP_CODE_MODE(LDY, 0xac, abs)
-        IS_OP_CODE_MODE(LDY, 0xbc, abs_x)
-
-        IS_OP_CODE_MODE(STX, 0x86, zp)
-        IS_OP_CODE_MODE(STX, 0x96, zp_ind_y)
-        IS_OP_CODE_MODE(STX, 0x8e, abs)
-        IS_OP_CODE_MODE(STY, 0x84, zp)
-        IS_OP_CODE_MODE(STY, 0x94, zp_ind_x)
-        IS_OP_CODE_MODE(STY, 0x8c, abs)
-
-        IS_OP_CODE_MODE(CPX, 0xe0, imm)
-        IS_OP_CODE_MODE(CPX, 0xe4, zp)
-        IS_OP_CODE_MODE(CPX, 0xec, abs)
-        IS_OP_CODE_MODE(CPY, 0xc0, imm)
-        IS_OP_CODE_MODE(CPY, 0xc4, zp)
-        IS_OP_CODE_MODE(CPY, 0xcc, abs)
-
-        IS_OP_CODE(TAX, 0xaa)
-        IS_OP_CODE(TAY, 0xa8)
-        IS_OP_CODE(TSX, 0xba)
-        IS_OP_CODE(TXA, 0x8a)
-        IS_OP_CODE(TXS, 0x9a)
-        IS_OP_CODE(TYA, 0x98)
-
-        IS_OP_CODE_MODE(INC, 0xe6, zp)
-        IS_OP_CODE_MODE(INC, 0xf6, zp_ind_x)
-        IS_OP_CODE_MODE(INC, 0xee, abs)
-        IS_OP_CODE_MODE(INC, 0xfe, abs_x)
-        IS_OP_CODE(INX, 0xe8)
-        IS_OP_CODE(INY, 0xc8)
-        IS_OP_CODE_MODE(DEC, 0xc6, zp)
-        IS_OP_CODE_MODE(DEC, 0xd6, zp_ind_x)
-        IS_OP_CODE_MODE(DEC, 0xce, abs)
-        IS_OP_CODE_MODE(DEC, 0xde, abs_x)
-        IS_OP_CODE(DEX, 0xca)
-        IS_OP_CODE(DEY, 0x88)
-
-        IS_OP_CODE(SEC, 0x38)
-        IS_OP_CODE(SED, 0xf8)
-        IS_OP_CODE(SEI, 0x78)
-        IS_OP_CODE(CLC, 0x18)
-        IS_OP_CODE(CLD, 0xd8)
-        IS_OP_CODE(CLI, 0x58)
-        IS_OP_CODE(CLV, 0xB8)
-
-        IS_OP_CODE_MODE(JMP, 0x4c, abs_jmp)
-        IS_OP_CODE_MODE(JMP, 0x6c, ind_jmp)
-
-        IS_OP_CODE_MODE(BCC, 0x90, rel)
-        IS_OP_CODE_MODE(BCS, 0xb0, rel)
-        IS_OP_CODE_MODE(BEQ, 0xf0, rel)
-        IS_OP_CODE_MODE(BMI, 0x30, rel)
-        IS_OP_CODE_MODE(BNE, 0xd0, rel)
-        IS_OP_CODE_MODE(BPL, 0x10, rel)
-        IS_OP_CODE_MODE(BVC, 0x50, rel)
-        IS_OP_CODE_MODE(BVS, 0x70, rel)
-
-        IS_OP_CODE_MODE(BIT, 0x24, zp)
-        IS_OP_CODE_MODE(BIT, 0x2c, abs)
-
-        IS_OP_CODE(PHA, 0x48)
-        IS_OP_CODE(PHP, 0x08)
-        IS_OP_CODE(PLA, 0x68)
-        IS_OP_CODE(PLP, 0x28)
-
-        IS_OP_CODE(RTI, 0x40)
-        IS_OP_CODE_MODE(JSR, 0x20, abs_jmp)
-
-        IS_OP_CODE(RTS, 0x60)
-
-        IS_OP_CODE(KIL, 0x02)
-        IS_OP_CODE(KIL, 0x12)
-        IS_OP_CODE(KIL, 0x22)
-        IS_OP_CODE(KIL, 0x32)
-        IS_OP_CODE(KIL, 0x42)
-        IS_OP_CODE(KIL, 0x52)
-        IS_OP_CODE(KIL, 0x62)
-        IS_OP_CODE(KIL, 0x72)
-        IS_OP_CODE(KIL, 0x92)
-        IS_OP_CODE(KIL, 0xB2)
-        IS_OP_CODE(KIL, 0xd2)
-        IS_OP_CODE(KIL, 0xf2)
-
-        IS_OP_CODE(BRK, 0x00)
-
-        // The real NOP
-        IS_OP_CODE_MODE(NOP, 0xea, imp)
-
-        //===============================================================================
-        // Unofficial instructions
-        //===============================================================================
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x80, imm)
-
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x04, zp)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x44, zp)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x64, zp)
-
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x0c, abs)
-
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x14, zp_ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x34, zp_ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x54, zp_ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x74, zp_ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0xd4, zp_ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0xf4, zp_ind_x)
-
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x1c, abs_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x3c, abs_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x5c, abs_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x7c, abs_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0xdc, abs_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0xfc, abs_x)
-
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x89, imm)
-
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x82, imm)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0xc2, imm)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0xe2, imm)
-
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x1a, imp)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x3a, imp)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x5a, imp)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0x7a, imp)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0xda, imp)
-        IS_UNOFFICIAL_OP_CODE_MODE(NOP, 0xfa, imp)
-
-        IS_UNOFFICIAL_OP_CODE_MODE(SLO, 0x03, ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(SLO, 0x07, zp)
-        IS_UNOFFICIAL_OP_CODE_MODE(ANC, 0x0b, imm)
-        IS_UNOFFICIAL_OP_CODE_MODE(SLO, 0x0f, abs)
-        IS_UNOFFICIAL_OP_CODE_MODE(SLO, 0x13, ind_y)
-        IS_UNOFFICIAL_OP_CODE_MODE(SLO, 0x17, zp_ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(SLO, 0x1b, abs_y)
-        IS_UNOFFICIAL_OP_CODE_MODE(SLO, 0x1f, abs_x)
-
-        IS_UNOFFICIAL_OP_CODE_MODE(RLA, 0x23, ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(RLA, 0x27, zp)
-        IS_UNOFFICIAL_OP_CODE_MODE(ANC, 0x2b, imm)
-        IS_UNOFFICIAL_OP_CODE_MODE(RLA, 0x2f, abs)
-        IS_UNOFFICIAL_OP_CODE_MODE(RLA, 0x33, ind_y)
-        IS_UNOFFICIAL_OP_CODE_MODE(RLA, 0x37, zp_ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(RLA, 0x3b, abs_y)
-        IS_UNOFFICIAL_OP_CODE_MODE(RLA, 0x3f, abs_x)
-
-        IS_UNOFFICIAL_OP_CODE_MODE(SRE, 0x43, ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(SRE, 0x47, zp)
-        IS_UNOFFICIAL_OP_CODE_MODE(ALR, 0x4b, imm)
-        IS_UNOFFICIAL_OP_CODE_MODE(SRE, 0x4f, abs)
-        IS_UNOFFICIAL_OP_CODE_MODE(SRE, 0x53, ind_y)
-        IS_UNOFFICIAL_OP_CODE_MODE(SRE, 0x57, zp_ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(SRE, 0x5b, abs_y)
-        IS_UNOFFICIAL_OP_CODE_MODE(SRE, 0x5f, abs_x)
-
-        IS_UNOFFICIAL_OP_CODE_MODE(RRA, 0x63, ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(RRA, 0x67, zp)
-        IS_UNOFFICIAL_OP_CODE_MODE(ARR, 0x6b, imm)
-        IS_UNOFFICIAL_OP_CODE_MODE(RRA, 0x6f, abs)
-        IS_UNOFFICIAL_OP_CODE_MODE(RRA, 0x73, ind_y)
-        IS_UNOFFICIAL_OP_CODE_MODE(RRA, 0x77, zp_ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(RRA, 0x7b, abs_y)
-        IS_UNOFFICIAL_OP_CODE_MODE(RRA, 0x7f, abs_x)
-
-        IS_UNOFFICIAL_OP_CODE_MODE(SAX, 0x83, ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(SAX, 0x87, zp)
-        IS_UNOFFICIAL_OP_CODE_MODE(XAA, 0x8b, imm)
-        IS_UNOFFICIAL_OP_CODE_MODE(SAX, 0x8f, abs)
-        IS_UNOFFICIAL_OP_CODE_MODE(AHX, 0x93, ind_y)
-        IS_UNOFFICIAL_OP_CODE_MODE(SAX, 0x97, zp_ind_y)
-        IS_UNOFFICIAL_OP_CODE_MODE(TAS, 0x9b, abs_y)
-        IS_UNOFFICIAL_OP_CODE_MODE(AHX, 0x9f, abs_y)
-
-        IS_UNOFFICIAL_OP_CODE_MODE(LAX, 0xa3, ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(LAX, 0xa7, zp)
-        IS_UNOFFICIAL_OP_CODE_MODE(LAX, 0xab, imm)
-        IS_UNOFFICIAL_OP_CODE_MODE(LAX, 0xaf, abs)
-        IS_UNOFFICIAL_OP_CODE_MODE(LAX, 0xb3, ind_y)
-        IS_UNOFFICIAL_OP_CODE_MODE(LAX, 0xb7, zp_ind_y)
-        IS_UNOFFICIAL_OP_CODE_MODE(LAS, 0xbb, zp_ind_y)
-        IS_UNOFFICIAL_OP_CODE_MODE(LAX, 0xbf, abs_y)
-
-        IS_UNOFFICIAL_OP_CODE_MODE(DCP, 0xc3, ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(DCP, 0xc7, zp)
-        IS_UNOFFICIAL_OP_CODE_MODE(AXS, 0xcb, imm)
-        IS_UNOFFICIAL_OP_CODE_MODE(DCP, 0xcf, abs)
-        IS_UNOFFICIAL_OP_CODE_MODE(DCP, 0xd3, ind_y)
-        IS_UNOFFICIAL_OP_CODE_MODE(DCP, 0xd7, zp_ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(DCP, 0xdb, abs_y)
-        IS_UNOFFICIAL_OP_CODE_MODE(DCP, 0xdf, abs_x)
-
-        IS_UNOFFICIAL_OP_CODE_MODE(ISC, 0xe3, ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(ISC, 0xe7, zp)
-        IS_UNOFFICIAL_OP_CODE_MODE(SBC, 0xeb, imm)
-        IS_UNOFFICIAL_OP_CODE_MODE(ISC, 0xef, abs)
-        IS_UNOFFICIAL_OP_CODE_MODE(ISC, 0xf3, ind_y)
-        IS_UNOFFICIAL_OP_CODE_MODE(ISC, 0xf7, zp_ind_x)
-        IS_UNOFFICIAL_OP_CODE_MODE(ISC, 0xfb, abs_y)
-        IS_UNOFFICIAL_OP_CODE_MODE(ISC, 0xff, abs_x)
-
-        default:
-            NES_TRACE0("[NES_CPU] Unrecognized instruction or illegal instruction!");
-            assert(false);
-            break;
+            NES_TRACE4(get_op_str());
+
+            nes_cycle_t start_cycle = _cycle;
+            (this->*s_op_table[_op_code].handler)();
+
+            if (_profile)
+                profile_op(pc, start_cycle);
+            return;
+        }
+
+        // One indirect call into the handler already specialized for the addressing mode
+        (this->*s_op_table[_op_code].handler)();
+    }
+}
+
+uint8_t nes_cpu::decode_op()
+{
+    uint16_t pc = _context.PC;
+
+    // Code running from RAM can change underneath us at any time - always decode
+    // Also skip the last 2 bytes of each bank as the operand comes from whatever bank is mapped after it
+    if (pc < PRG_ROM_START || pc % PRG_BANK_SIZE > PRG_BANK_SIZE - 3)
+    {
+        _operand_prefetched = false;
+        return decode_byte();
+    }
+
+    if (_decoded_prg_generation != _mem->prg_generation())
+        map_decoded_banks();
+
+    int slot = (pc - PRG_ROM_START) / PRG_BANK_SIZE;
+    nes_decoded_op *ops = _decoded_slots[slot];
+    if (!ops)
+    {
+        if (!_mem->is_prg_rom(pc))
+        {
+            _operand_prefetched = false;
+            return decode_byte();
         }
+
+        // First time running code from this bank (in this slot)
+        nes_decoded_bank &bank = _decoded_banks[_mem->prg_bank(pc)];
+        if (!bank)
+            bank.reset(new nes_decoded_op[PRG_BANK_SIZE]());
+        ops = _decoded_slots[slot] = bank.get();
+    }
+
+    nes_decoded_op &decoded = ops[pc % PRG_BANK_SIZE];
+    if (!decoded.decoded)
+    {
+        decoded.op_code = peek(pc);
+        decoded.operand = peek_word(pc + 1);
+        decoded.decoded = true;
+    }
+
+    _context.PC = pc + 1;
+    _operand = decoded.operand;
+    _operand_prefetched = true;
+    return decoded.op_code;
+}
+
+// Point each slot at the decoded table of the bank mapped there now - null if there isn't one yet
+void nes_cpu::map_decoded_banks()
+{
+    if (_decoded_prg_rom_generation != _mem->prg_rom_generation())
+    {
+        // Different PRG ROM - what we've decoded is for some other code
+        _decoded_banks.clear();
+        _decoded_prg_rom_generation = _mem->prg_rom_generation();
+    }
+
+    for (int slot = 0; slot < PRG_BANK_SLOT_COUNT; ++slot)
+    {
+        uint16_t addr = uint16_t(PRG_ROM_START + slot * PRG_BANK_SIZE);
+        uint16_t bank = _mem->prg_bank(addr);
+        if (bank >= _decoded_banks.size())
+            _decoded_banks.resize(bank + 1);
+
+        _decoded_slots[slot] = _mem->is_prg_rom(addr) ? _decoded_banks[bank].get() : nullptr;
     }
+
+    _decoded_prg_generation = _mem->prg_generation();
 }
 
+//
+// Games spend a lot of time in loops such as LDA $2002 / BPL or LDA flag / BEQ waiting for VBlank/NMI
+// If one full iteration of the loop ends up with the same registers without writing anything or reading
+// any IO register (other than PPUSTATUS), every following iteration is going to be identical until
+// something external changes - next NMI/PPU event (which run_to never goes past) or PPUSTATUS change
+// So we skip the whole iterations in one go and move the cycle count accordingly
+//
+void nes_cpu::detect_idle_loop()
+{
+    if (_idle_loop.head == PC() &&
+        _idle_loop.side_effect_count == _mem->side_effect_count() &&
+        _idle_loop.context.A == A() && _idle_loop.context.X == X() && _idle_loop.context.Y == Y() &&
+        _idle_loop.context.S == S() && _idle_loop.context.P == P() &&
+        !_nmi_pending && !_dma_pending)
+    {
+        nes_cycle_t iteration = _cycle - _idle_loop.cycle;
+        nes_cycle_t limit = _run_to_cycle;
+        // PPUSTATUS needs to stay the same from the iteration we've just seen all the way to the last one
+        // we skip
+        if (_idle_loop.status_read_count != _mem->status_read_count())
+            limit = min(limit, _ppu->next_status_change_cycle(_idle_loop.cycle));
+
+        if (limit > _cycle && iteration > nes_cycle_t(0))
+        {
+            int64_t skip = (limit - _cycle) / iteration;
+            _cycle += iteration * skip;
+        }
+    }
+
+    _idle_loop.head = PC();
+    _idle_loop.context = _context;
+    _idle_loop.context.P = P();
+    _idle_loop.cycle = _cycle;
+    _idle_loop.side_effect_count = _mem->side_effect_count();
+    _idle_loop.status_read_count = _mem->status_read_count();
+}
+
+template<nes_addr_mode addr_mode>
+void nes_cpu::ILL()
+{
+    NES_TRACE0("[NES_CPU] Unrecognized instruction or illegal instruction!");
+    assert(false);
+}
+
+
 static void append_space(string &str)
 {
     str.append(1, ' ');
@@ -397,38 +720,11 @@ static void align(string &str, int loc)
 // 0         1         2         3         4         5         6         7         8
 // 012345678901234567890123456789012345678901234567890123456789012345678901234567890
 // C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD CYC:  0
-string nes_cpu::get_op_str(const char *op, nes_addr_mode addr_mode, bool is_official)
+string nes_cpu::get_op_str()
 {
     nes_ppu_protect protect(_ppu);
 
-    int operand_size = 0;
-    switch (addr_mode)
-    {
-        case nes_addr_mode::nes_addr_mode_imp:
-        case nes_addr_mode::nes_addr_mode_acc:
-            break;
-
-        case nes_addr_mode::nes_addr_mode_rel:
-        case nes_addr_mode::nes_addr_mode_imm:
-        case nes_addr_mode::nes_addr_mode_zp:
-        case nes_addr_mode::nes_addr_mode_zp_ind_x:
-        case nes_addr_mode::nes_addr_mode_zp_ind_y:
-        case nes_addr_mode::nes_addr_mode_ind_x:
-        case nes_addr_mode::nes_addr_mode_ind_y:
-            operand_size = 1;
-            break;
-
-        case nes_addr_mode::nes_addr_mode_ind_jmp:
-        case nes_addr_mode::nes_addr_mode_abs:
-        case nes_addr_mode::nes_addr_mode_abs_jmp:
-        case nes_addr_mode::nes_addr_mode_abs_x:
-        case nes_addr_mode::nes_addr_mode_abs_y:
-            operand_size = 2;
-            break;
-
-        default:
-            assert(false);
-    }
+    const nes_op_entry &op = s_op_table[_op_code];
 
     string msg;
 
@@ -442,13 +738,13 @@ string nes_cpu::get_op_str(const char *op, nes_addr_mode addr_mode, bool is_offi
     align(msg, 6);
 
     // Dump instruction bytes
-    for (int i = 0; i < operand_size + 1; ++i)
+    for (int i = 0; i < s_op_length[_op_code]; ++i)
     {
         append_byte(msg, peek(PC() - 1 + i));
         append_space(msg);
     }
 
-    if (is_official)
+    if (op.is_official)
     {
         align(msg, 16);
     }
@@ -458,8 +754,8 @@ string nes_cpu::get_op_str(const char *op, nes_addr_mode addr_mode, bool is_offi
         msg.append("*");
     }
 
-    msg.append(op);
-    append_operand_str(msg, addr_mode);
+    msg.append(op.name);
+    append_operand_str(msg, op.addr_mode);
 
     align(msg, 48);
 
@@ -628,41 +924,19 @@ void nes_cpu::append_operand_str(string &str, nes_addr_mode addr_mode)
     }
 }
 
-nes_cpu_cycle_t nes_cpu::get_cpu_cycle(operand_t operand, nes_addr_mode mode)
+nes_cpu_cycle_t nes_cpu::get_cpu_cycle()
 {
-    switch (mode)
-    {
-    case nes_addr_mode_acc:
-    case nes_addr_mode_imm:
-        return nes_cpu_cycle_t(2);
-
-    case nes_addr_mode_zp:
-        return nes_cpu_cycle_t(3);
-
-    case nes_addr_mode_zp_ind_x:
-    case nes_addr_mode_zp_ind_y:
-    case nes_addr_mode_abs:
-        return nes_cpu_cycle_t(4);
-
-    case nes_addr_mode_abs_x:
-    case nes_addr_mode_abs_y:
-        return nes_cpu_cycle_t(operand.is_page_crossing ? 5 : 4);
-
-    case nes_addr_mode_ind_x:
-        return nes_cpu_cycle_t(6);
-
-    case nes_addr_mode_ind_y:
-        return nes_cpu_cycle_t(operand.is_page_crossing ? 6 : 5);
+    return nes_cpu_cycle_t(s_op_cycles[_op_code]);
+}
 
-    default:
-        assert(false);
-        return nes_cpu_cycle_t(0);
-    }
+nes_cpu_cycle_t nes_cpu::get_cpu_cycle(operand_t operand)
+{
+    return nes_cpu_cycle_t(s_op_cycles[_op_code] + (operand.is_page_crossing ? s_op_page_cross[_op_code] : 0));
 }
 
 nes_cpu_cycle_t nes_cpu::get_branch_cycle(bool cond, uint16_t new_addr, int8_t rel)
 {
-    int cycle = 2;
+    int cycle = s_op_cycles[_op_code];
 
     if (cond)
     {
@@ -679,24 +953,6 @@ nes_cpu_cycle_t nes_cpu::get_branch_cycle(bool cond, uint16_t new_addr, int8_t r
     return nes_cpu_cycle_t(cycle);
 }
 
-#define BEGIN_CYCLE() { nes_cpu_cycle_t __cycle_count(0);
-#define IS_CYCLE(mode, cycle) if (addr_mode == nes_addr_mode_##mode) __cycle_count = nes_cpu_cycle_t(cycle);
-#define END_CYCLE() step_cpu(__cycle_count); }
-#define END_CYCLE_RETURN() return __cycle_count; }
-
-nes_cpu_cycle_t nes_cpu::get_shift_cycle(nes_addr_mode addr_mode)
-{
-    BEGIN_CYCLE()
-    {
-        IS_CYCLE(acc, 2);
-        IS_CYCLE(zp, 5);
-        IS_CYCLE(zp_ind_x, 6);
-        IS_CYCLE(abs, 6);
-        IS_CYCLE(abs_x, 7);
-    }
-    END_CYCLE_RETURN()
-}
-
 void nes_cpu::step_cpu(int64_t cpu_cycle)
 {
     _cycle += nes_cpu_cycle_t(cpu_cycle);
@@ -708,14 +964,15 @@ void nes_cpu::step_cpu(nes_cpu_cycle_t cpu_cycle)
 }
 
 // Add with carry
-void nes_cpu::ADC(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::ADC()
 {
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
     _ADC(val);
 
     // cycle count
-    step_cpu(get_cpu_cycle(op, addr_mode));
+    step_cpu(get_cpu_cycle(op));
 }
 
 void nes_cpu::_ADC(uint8_t val)
@@ -742,9 +999,10 @@ void nes_cpu::_ADC(uint8_t val)
 }
 
 // Logical AND
-void nes_cpu::AND(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::AND()
 {
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
     A() &= val;
 
@@ -752,13 +1010,14 @@ void nes_cpu::AND(nes_addr_mode addr_mode)
     calc_alu_flag(A());
 
     // cycle count
-    step_cpu(get_cpu_cycle(op, addr_mode));
+    step_cpu(get_cpu_cycle(op));
 }
 
 // Compare
-void nes_cpu::CMP(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::CMP()
 {
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);;
 
     // flags
@@ -769,13 +1028,14 @@ void nes_cpu::CMP(nes_addr_mode addr_mode)
     set_negative_flag(diff & 0x80);
 
     // cycle count
-    step_cpu(get_cpu_cycle(op, addr_mode));
+    step_cpu(get_cpu_cycle(op));
 }
 
 // Exclusive OR
-void nes_cpu::EOR(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::EOR()
 {
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
 
     A() ^= val;
@@ -784,13 +1044,14 @@ void nes_cpu::EOR(nes_addr_mode addr_mode)
     calc_alu_flag(A());
 
     // cycle count
-    step_cpu(get_cpu_cycle(op, addr_mode));
+    step_cpu(get_cpu_cycle(op));
 }
 
 // Logical Inclusive OR
-void nes_cpu::ORA(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::ORA()
 {
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
 
     A() |= val;
@@ -798,19 +1059,20 @@ void nes_cpu::ORA(nes_addr_mode addr_mode)
     calc_alu_flag(A());
 
     // cycle count
-    step_cpu(get_cpu_cycle(op, addr_mode));
+    step_cpu(get_cpu_cycle(op));
 }
 
 // Subtract with carry
-void nes_cpu::SBC(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::SBC()
 {
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
 
     _SBC(val);
 
     // cycle count
-    step_cpu(get_cpu_cycle(op, addr_mode));
+    step_cpu(get_cpu_cycle(op));
 }
 
 void nes_cpu::_SBC(uint8_t val)
@@ -819,9 +1081,10 @@ void nes_cpu::_SBC(uint8_t val)
 }
 
 // Load Accumulator
-void nes_cpu::LDA(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::LDA()
 {
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
 
     A() = val;
@@ -830,13 +1093,14 @@ void nes_cpu::LDA(nes_addr_mode addr_mode)
     calc_alu_flag(A());
 
     // cycle count
-    step_cpu(get_cpu_cycle(op, addr_mode));
+    step_cpu(get_cpu_cycle(op));
 }
 
 // ASL - Arithmetic shift left
-void nes_cpu::ASL(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::ASL()
 {
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
     uint8_t new_val = val << 1;
     write_operand(op, new_val);
@@ -850,7 +1114,7 @@ void nes_cpu::ASL(nes_addr_mode addr_mode)
     set_negative_flag(new_val & 0x80);
 
     // cycle count
-    step_cpu(get_shift_cycle(addr_mode));
+    step_cpu(get_cpu_cycle());
 }
 
 void nes_cpu::branch(bool cond, nes_addr_mode addr_mode)
@@ -869,30 +1133,37 @@ void nes_cpu::branch(bool cond, nes_addr_mode addr_mode)
 
     // cycle count
     step_cpu(get_branch_cycle(cond, PC(), rel));
+
+    if (cond && rel < 0 && _detect_idle_loop)
+        detect_idle_loop();
 }
 
 // BCC - Branch if Carry Clear
-void nes_cpu::BCC(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::BCC()
 {
     branch(!get_carry(), addr_mode);
 }
 
 // BCS - Branch if Carry Set
-void nes_cpu::BCS(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::BCS()
 {
     branch(get_carry(), addr_mode);
 }
 
 // BEQ - Branch if Equal
-void nes_cpu::BEQ(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::BEQ()
 {
     branch(is_zero(), addr_mode);
 }
 
 // BIT - Bit test
-void nes_cpu::BIT(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::BIT()
 {
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
     uint8_t new_val = val & A();
 
@@ -902,64 +1173,71 @@ void nes_cpu::BIT(nes_addr_mode addr_mode)
     set_negative_flag(val & 0x80);
 
     // cycle count
-    step_cpu(get_cpu_cycle(op, addr_mode));
+    step_cpu(get_cpu_cycle(op));
 }
 
 // BMI - Branch if minus
-void nes_cpu::BMI(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::BMI()
 {
     branch(is_negative(), addr_mode);
 }
 
 // BNE - Branch if not equal
-void nes_cpu::BNE(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::BNE()
 {
     branch(!is_zero(), addr_mode);
 }
 
 // BPL - Branch if positive
-void nes_cpu::BPL(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::BPL()
 {
     branch(!is_negative(), addr_mode);
 }
 
 // BRK - Force interrupt
-void nes_cpu::BRK(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::BRK()
 {
     // cycle count
-    step_cpu(7);
+    step_cpu(get_cpu_cycle());
 
     _system->stop();
 }
 
 // BVC - Branch if overflow clear
-void nes_cpu::BVC(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::BVC()
 {
     branch(!is_overflow(), addr_mode);
 }
 
 // BVS - Branch if overflow set
-void nes_cpu::BVS(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::BVS()
 {
     branch(is_overflow(), addr_mode);
 }
 
 // CLC - Clear carry flag
-void nes_cpu::CLC(nes_addr_mode addr_mode) { set_carry_flag(false); step_cpu(nes_cpu_cycle_t(2)); }
+template<nes_addr_mode addr_mode> void nes_cpu::CLC() { set_carry_flag(false); step_cpu(get_cpu_cycle()); }
 
 // CLD - Clear decimal mode
-void nes_cpu::CLD(nes_addr_mode addr_mode) { set_decimal_flag(false); step_cpu(nes_cpu_cycle_t(2)); }
+template<nes_addr_mode addr_mode> void nes_cpu::CLD() { set_decimal_flag(false); step_cpu(get_cpu_cycle()); }
 
 // CLI - Clear interrupt disable
-void nes_cpu::CLI(nes_addr_mode addr_mode) { set_interrupt_flag(false); step_cpu(nes_cpu_cycle_t(2)); }
+template<nes_addr_mode addr_mode> void nes_cpu::CLI() { set_interrupt_flag(false); step_cpu(get_cpu_cycle()); }
 
 // CLV - Clear overflow flag
-void nes_cpu::CLV(nes_addr_mode addr_mode) { set_overflow_flag(false); step_cpu(nes_cpu_cycle_t(2)); }
+template<nes_addr_mode addr_mode> void nes_cpu::CLV() { set_overflow_flag(false); step_cpu(get_cpu_cycle()); }
 
 // CPX - Compare X register
-void nes_cpu::CPX(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::CPX()
 {
-    auto op = decode_operand(addr_mode);
+    auto op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
 
     // flags
@@ -970,13 +1248,14 @@ void nes_cpu::CPX(nes_addr_mode addr_mode)
     set_negative_flag(diff & 0x80);
 
     // cycle count
-    step_cpu(get_cpu_cycle(op, addr_mode));
+    step_cpu(get_cpu_cycle(op));
 }
 
 // CPY - Compare Y register
-void nes_cpu::CPY(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::CPY()
 {
-    auto op = decode_operand(addr_mode);
+    auto op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);;
 
     // flags
@@ -987,95 +1266,88 @@ void nes_cpu::CPY(nes_addr_mode addr_mode)
     set_negative_flag(diff & 0x80);
 
     // cycle count
-    step_cpu(get_cpu_cycle(op, addr_mode));
+    step_cpu(get_cpu_cycle(op));
 }
 
 // DEC - Decrement memory
-void nes_cpu::DEC(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::DEC()
 {
-    uint16_t addr = decode_operand_addr(addr_mode);
+    uint16_t addr = decode_operand_addr<addr_mode>();
     uint8_t new_val = peek(addr) - 1;
     poke(addr, new_val);
 
     calc_alu_flag(new_val);
 
-    BEGIN_CYCLE()
-    {
-        IS_CYCLE(zp, 5);
-        IS_CYCLE(zp_ind_x, 6);
-        IS_CYCLE(abs, 6);
-        IS_CYCLE(abs_x, 7);
-    }
-    END_CYCLE()
+    step_cpu(get_cpu_cycle());
 }
 
 // DEX - Decrement X register
-void nes_cpu::DEX(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::DEX()
 {
     X()--;
     calc_alu_flag(X());
 
     // cycle count
-    step_cpu(nes_cpu_cycle_t(2));
+    step_cpu(get_cpu_cycle());
 }
 
 // DEY - Decrement Y register
-void nes_cpu::DEY(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::DEY()
 {
     Y()--;
     calc_alu_flag(Y());
 
     // cycle count
-    step_cpu(nes_cpu_cycle_t(2));
+    step_cpu(get_cpu_cycle());
 }
 
 // INC - Increment memory
-void nes_cpu::INC(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::INC()
 {
-    uint16_t addr = decode_operand_addr(addr_mode);
+    uint16_t addr = decode_operand_addr<addr_mode>();
     uint8_t new_val = peek(addr) + 1;
     poke(addr, new_val);
 
     // flags
     calc_alu_flag(new_val);
 
-    BEGIN_CYCLE()
-    {
-        IS_CYCLE(zp, 5);
-        IS_CYCLE(zp_ind_x, 6);
-        IS_CYCLE(abs, 6);
-        IS_CYCLE(abs_x, 7);
-    }
-    END_CYCLE()
+    step_cpu(get_cpu_cycle());
 }
 
 // INX - Increment X
-void nes_cpu::INX(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::INX()
 {
     X() = X() + 1;
 
     calc_alu_flag(X());
 
-    step_cpu(nes_cpu_cycle_t(2));
+    step_cpu(get_cpu_cycle());
 }
 
 // INY - Increment Y
-void nes_cpu::INY(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::INY()
 {
     Y() = Y() + 1;
 
     calc_alu_flag(Y());
 
-    step_cpu(nes_cpu_cycle_t(2));
+    step_cpu(get_cpu_cycle());
 }
 
 // JMP - Jump
-void nes_cpu::JMP(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::JMP()
 {
     assert(addr_mode == nes_addr_mode_abs_jmp || addr_mode == nes_addr_mode_ind_jmp);
 
     uint16_t old_pc = PC();
-    auto addr = decode_operand_addr(addr_mode);
+    auto addr = decode_operand_addr<addr_mode>();
     if (addr == PC() - 1 && _stop_at_infinite_loop)
     {
         _system->stop();
@@ -1084,48 +1356,55 @@ void nes_cpu::JMP(nes_addr_mode addr_mode)
     PC() = addr;
 
     // No impact to flags
-    step_cpu(addr_mode == nes_addr_mode_abs_jmp ? 3 : 5);
+    step_cpu(get_cpu_cycle());
+
+    if (addr < old_pc && _detect_idle_loop)
+        detect_idle_loop();
 }
 
 // JSR - Jump to subroutine
-void nes_cpu::JSR(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::JSR()
 {
     // note: we push the actual return address -1, which is the current place (before decoding the 16-bit addr) + 1
     push_word(PC() + 1);
 
-    PC() = decode_operand_addr(addr_mode);
+    PC() = decode_operand_addr<addr_mode>();
 
-    step_cpu(6);
+    step_cpu(get_cpu_cycle());
 }
 
 // LDX - Load X register
-void nes_cpu::LDX(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::LDX()
 {
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     X() = read_operand(op);
 
     calc_alu_flag(X());
 
     // cycle count
-    step_cpu(get_cpu_cycle(op, addr_mode));
+    step_cpu(get_cpu_cycle(op));
 }
 
 // LDY - Load Y register
-void nes_cpu::LDY(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::LDY()
 {
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     Y() = read_operand(op);
 
     calc_alu_flag(Y());
 
     // cycle count
-    step_cpu(get_cpu_cycle(op, addr_mode));
+    step_cpu(get_cpu_cycle(op));
 }
 
 // LSR - Logical shift right
-void nes_cpu::LSR(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::LSR()
 {
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
     uint8_t new_val = (val >> 1);
     write_operand(op, new_val);
@@ -1139,58 +1418,63 @@ void nes_cpu::LSR(nes_addr_mode addr_mode)
     set_negative_flag(new_val & 0x80);
 
     // cycle count
-    step_cpu(get_shift_cycle(addr_mode));
+    step_cpu(get_cpu_cycle());
 }
 
 // NOP - NOP
-void nes_cpu::NOP(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::NOP()
 {
     // For effective NOP (op codes that are "effectively" no-op but not the real NOP 0xea)
     // We always needed to decode the parameter
     if (addr_mode != nes_addr_mode::nes_addr_mode_imp)
     {
-        operand_t op = decode_operand(addr_mode);
-        step_cpu(get_cpu_cycle(op, addr_mode));
+        operand_t op = decode_operand<addr_mode>();
+        step_cpu(get_cpu_cycle(op));
     }
     else
     {
-        step_cpu(nes_cpu_cycle_t(2));
+        step_cpu(get_cpu_cycle());
     }
 }
 
 // PHA - Push accumulator
-void nes_cpu::PHA(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::PHA()
 {
     push_byte(A());
 
-    step_cpu(3);
+    step_cpu(get_cpu_cycle());
 }
 
 // PHP - Push processor status
-void nes_cpu::PHP(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::PHP()
 {
     // http://wiki.nesdev.com/w/index.php/CPU_status_flag_behavior
     // Set bit 5 and 4 to 1 when copy status into from PHP
     push_byte(P() | 0x30);
 
-    step_cpu(3);
+    step_cpu(get_cpu_cycle());
 }
 
 // PLA - Pull accumulator
-void nes_cpu::PLA(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::PLA()
 {
     A() = pop_byte();
 
     calc_alu_flag(A());
 
-    step_cpu(4);
+    step_cpu(get_cpu_cycle());
 }
 
 // PLP - Pull processor status
-void nes_cpu::PLP(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::PLP()
 {
     _PLP();
-    step_cpu(4);
+    step_cpu(get_cpu_cycle());
 }
 
 void nes_cpu::_PLP()
@@ -1199,13 +1483,14 @@ void nes_cpu::_PLP()
     // Bit 5 and 4 are ignored when pulled from stack - which means they are preserved
     // @TODO - Nintendulator actually always sets bit 5, not sure which one is correct
     // I'm setting bit 5 to make testing easier
-    P() = (pop_byte() & 0xef) | (P() & 0x10) | 0x20;
+    set_P((pop_byte() & 0xef) | (P() & 0x10) | 0x20);
 }
 
 // ROL - Rotate left
-void nes_cpu::ROL(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::ROL()
 {
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
     uint8_t new_val = (val << 1) | get_carry();
     write_operand(op, new_val);
@@ -1218,13 +1503,14 @@ void nes_cpu::ROL(nes_addr_mode addr_mode)
     set_negative_flag(new_val & 0x80);
 
     // cycle count
-    step_cpu(get_shift_cycle(addr_mode));
+    step_cpu(get_cpu_cycle());
 }
 
 // ROR - Rotate right
-void nes_cpu::ROR(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::ROR()
 {
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
     uint8_t new_val = (val >> 1) | (get_carry() << 7);
     write_operand(op, new_val);
@@ -1238,58 +1524,61 @@ void nes_cpu::ROR(nes_addr_mode addr_mode)
     set_negative_flag(new_val & 0x80);
 
     // cycle count
-    step_cpu(get_shift_cycle(addr_mode));
+    step_cpu(get_cpu_cycle());
 }
 
 // RTI - Return from interrupt
-void nes_cpu::RTI(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::RTI()
 {
     _PLP();
 
     uint16_t addr = pop_word();
     PC() = addr;
 
-    step_cpu(6);
+    step_cpu(get_cpu_cycle());
 }
 
 // RTS - Return from subroutine
-void nes_cpu::RTS(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::RTS()
 {
     // See JSR - we pushed actual return address - 1
     uint16_t addr = pop_word() + 1;
     PC() = addr;
 
-    step_cpu(6);
+    step_cpu(get_cpu_cycle());
 }
 
 // SEC - Set carry flag
-void nes_cpu::SEC(nes_addr_mode addr_mode) { set_carry_flag(true); step_cpu(nes_cpu_cycle_t(2));  }
+template<nes_addr_mode addr_mode> void nes_cpu::SEC() { set_carry_flag(true); step_cpu(get_cpu_cycle());  }
 
 // SED - Set decimal flag
-void nes_cpu::SED(nes_addr_mode addr_mode) { set_decimal_flag(true); step_cpu(nes_cpu_cycle_t(2)); }
+template<nes_addr_mode addr_mode> void nes_cpu::SED() { set_decimal_flag(true); step_cpu(get_cpu_cycle()); }
 
 // SEI - Set interrupt disable
-void nes_cpu::SEI(nes_addr_mode addr_mode) { set_interrupt_flag(true); step_cpu(nes_cpu_cycle_t(2)); }
+template<nes_addr_mode addr_mode> void nes_cpu::SEI() { set_interrupt_flag(true); step_cpu(get_cpu_cycle()); }
 
 // Store Accumulator
-void nes_cpu::STA(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::STA()
 {
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     assert(op.kind == operand_kind::operand_kind_addr);;
 
     poke(op.addr_or_value, A());
 
     // Doesn't impact any flags
 
-    // this instruction forces page-crossing timing
-    op.is_page_crossing = true;
-    step_cpu(get_cpu_cycle(op, addr_mode));
+    // this instruction always takes page-crossing timing - already part of its base cycles
+    step_cpu(get_cpu_cycle(op));
 }
 
 // STX - Store X
-void nes_cpu::STX(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::STX()
 {
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     assert(op.kind == operand_kind::operand_kind_addr);
 
     poke(op.addr_or_value, X());
@@ -1297,13 +1586,14 @@ void nes_cpu::STX(nes_addr_mode addr_mode)
     // Doesn't impact any flags
 
     // cycle count
-    step_cpu(get_cpu_cycle(op, addr_mode));
+    step_cpu(get_cpu_cycle(op));
 }
 
 // STY- Store Y
-void nes_cpu::STY(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::STY()
 {
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     assert(op.kind == operand_kind::operand_kind_addr);
 
     poke(op.addr_or_value, Y());;
@@ -1311,71 +1601,78 @@ void nes_cpu::STY(nes_addr_mode addr_mode)
     // Doesn't impact any flags
 
     // cycle count
-    step_cpu(get_cpu_cycle(op, addr_mode));
+    step_cpu(get_cpu_cycle(op));
 }
 
 // TAX - Transfer accumulator to X
-void nes_cpu::TAX(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::TAX()
 {
     X() = A();
 
     calc_alu_flag(X());
 
-    step_cpu(nes_cpu_cycle_t(2));
+    step_cpu(get_cpu_cycle());
 }
 
 // TAY - Transfer accumulator to Y
-void nes_cpu::TAY(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::TAY()
 {
     Y() = A();
 
     calc_alu_flag(Y());
 
-    step_cpu(nes_cpu_cycle_t(2));
+    step_cpu(get_cpu_cycle());
 }
 
 // TSX - Transfer stack pointer to X
-void nes_cpu::TSX(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::TSX()
 {
     X() = S();
 
     calc_alu_flag(X());
 
-    step_cpu(nes_cpu_cycle_t(2));
+    step_cpu(get_cpu_cycle());
 }
 
 // TXA - Transfer X to acc
-void nes_cpu::TXA(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::TXA()
 {
     A() = X();
 
     calc_alu_flag(A());
 
-    step_cpu(nes_cpu_cycle_t(2));
+    step_cpu(get_cpu_cycle());
 }
 
 // TXS - Transfer X to stack pointer
-void nes_cpu::TXS(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::TXS()
 {
     S() = X();
 
     // Doesn't impact flags
 
-    step_cpu(nes_cpu_cycle_t(2));
+    step_cpu(get_cpu_cycle());
 }
 
 // TYA - Transfer Y to accumulator
-void nes_cpu::TYA(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::TYA()
 {
     A() = Y();
 
     calc_alu_flag(A());
 
-    step_cpu(nes_cpu_cycle_t(2));
+    step_cpu(get_cpu_cycle());
 }
 
 // KIL - Kill?
-void nes_cpu::KIL(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::KIL()
 {
     _system->stop();
 }
@@ -1384,16 +1681,17 @@ void nes_cpu::KIL(nes_addr_mode addr_mode)
 // Unofficial OP codes
 //===================================================================================
 
-void nes_cpu::ALR(nes_addr_mode addr_mode) { assert(false); }
-void nes_cpu::ANC(nes_addr_mode addr_mode) { assert(false); }
-void nes_cpu::ARR(nes_addr_mode addr_mode) { assert(false); }
-void nes_cpu::AXS(nes_addr_mode addr_mode) { assert(false); }
+template<nes_addr_mode addr_mode> void nes_cpu::ALR() { assert(false); }
+template<nes_addr_mode addr_mode> void nes_cpu::ANC() { assert(false); }
+template<nes_addr_mode addr_mode> void nes_cpu::ARR() { assert(false); }
+template<nes_addr_mode addr_mode> void nes_cpu::AXS() { assert(false); }
 
 // LAX - LDA value then TAX
-void nes_cpu::LAX(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::LAX()
 {
     // LDA + TAX
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
     X() = A() = val;
 
@@ -1401,24 +1699,26 @@ void nes_cpu::LAX(nes_addr_mode addr_mode)
     calc_alu_flag(X());
 
     // cycle count
-    step_cpu(get_cpu_cycle(op, addr_mode));
+    step_cpu(get_cpu_cycle(op));
 }
 
 // SAX - AND A X
-void nes_cpu::SAX(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::SAX()
 {
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     write_operand(op, A() & X());
 
     // cycle count
-    step_cpu(get_cpu_cycle(op, addr_mode));
+    step_cpu(get_cpu_cycle(op));
 }
 
 // DCP - DEC value then CMP value
-void nes_cpu::DCP(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::DCP()
 {
     // DEC
-    auto op = decode_operand(addr_mode);
+    auto op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
     val--;
     write_operand(op, val);
@@ -1430,16 +1730,16 @@ void nes_cpu::DCP(nes_addr_mode addr_mode)
     set_zero_flag(diff == 0);
     set_negative_flag(diff & 0x80);
 
-    // cycle count forces page crossing behavior (then +2)
-    op.is_page_crossing = true;
-    step_cpu(get_cpu_cycle(op, addr_mode) + nes_cpu_cycle_t(2));
+    // cycle count includes forced page crossing behavior (then +2)
+    step_cpu(get_cpu_cycle(op));
 }
 
 // ISC - INC value then SBC value
-void nes_cpu::ISC(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::ISC()
 {
     // INC
-    auto op = decode_operand(addr_mode);
+    auto op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
     val++;
     write_operand(op, val);
@@ -1447,16 +1747,16 @@ void nes_cpu::ISC(nes_addr_mode addr_mode)
     // SBC
     _SBC(val);
 
-    // cycle count forces page crossing behavior (then +2)
-    op.is_page_crossing = true;
-    step_cpu(get_cpu_cycle(op, addr_mode) + nes_cpu_cycle_t(2));
+    // cycle count includes forced page crossing behavior (then +2)
+    step_cpu(get_cpu_cycle(op));
 }
 
 // RLA - ROL value then AND value
-void nes_cpu::RLA(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::RLA()
 {
     // ROL
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
     uint8_t new_val = (val << 1) | get_carry();
     write_operand(op, new_val);
@@ -1469,15 +1769,15 @@ void nes_cpu::RLA(nes_addr_mode addr_mode)
     // flags
     calc_alu_flag(A());
 
-    // cycle count forces page crossing behavior (then +2)
-    op.is_page_crossing = true;
-    step_cpu(get_cpu_cycle(op, addr_mode) + nes_cpu_cycle_t(2));
+    // cycle count includes forced page crossing behavior (then +2)
+    step_cpu(get_cpu_cycle(op));
 }
 
-void nes_cpu::RRA(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::RRA()
 {
     // ROR
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
     uint8_t new_val = (val >> 1) | (get_carry() << 7);
     write_operand(op, new_val);
@@ -1487,16 +1787,16 @@ void nes_cpu::RRA(nes_addr_mode addr_mode)
     // ADC
     _ADC(new_val);
 
-    // cycle count forces page crossing behavior (then +2)
-    op.is_page_crossing = true;
-    step_cpu(get_cpu_cycle(op, addr_mode) + nes_cpu_cycle_t(2));
+    // cycle count includes forced page crossing behavior (then +2)
+    step_cpu(get_cpu_cycle(op));
 }
 
 // SLO - ASL value then ORA value
-void nes_cpu::SLO(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::SLO()
 {
     // ASL
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
     uint8_t new_val = val << 1;
     write_operand(op, new_val);
@@ -1508,16 +1808,16 @@ void nes_cpu::SLO(nes_addr_mode addr_mode)
 
     calc_alu_flag(A());
 
-    // cycle count forces page crossing behavior (then +2)
-    op.is_page_crossing = true;
-    step_cpu(get_cpu_cycle(op, addr_mode) + nes_cpu_cycle_t(2));
+    // cycle count includes forced page crossing behavior (then +2)
+    step_cpu(get_cpu_cycle(op));
 }
 
 // SRE - LSR value then EOR value
-void nes_cpu::SRE(nes_addr_mode addr_mode)
+template<nes_addr_mode addr_mode>
+void nes_cpu::SRE()
 {
     // LSR
-    operand_t op = decode_operand(addr_mode);
+    operand_t op = decode_operand<addr_mode>();
     uint8_t val = read_operand(op);
     uint8_t new_val = (val >> 1);
     write_operand(op, new_val);
@@ -1531,12 +1831,16 @@ void nes_cpu::SRE(nes_addr_mode addr_mode)
     // flags
     calc_alu_flag(A());
 
-    // cycle count forces page crossing behavior (then +2)
-    op.is_page_crossing = true;
-    step_cpu(get_cpu_cycle(op, addr_mode) + nes_cpu_cycle_t(2));
+    // cycle count includes forced page crossing behavior (then +2)
+    step_cpu(get_cpu_cycle(op));
 }
 
-void nes_cpu::XAA(nes_addr_mode addr_mode) { assert(false); }
-void nes_cpu::AHX(nes_addr_mode addr_mode) { assert(false); }
-void nes_cpu::TAS(nes_addr_mode addr_mode) { assert(false); }
-void nes_cpu::LAS(nes_addr_mode addr_mode) { assert(false); }
\ No newline at end of file
+template<nes_addr_mode addr_mode> void nes_cpu::XAA() { assert(false); }
+template<nes_addr_mode addr_mode> void nes_cpu::AHX() { assert(false); }
+template<nes_addr_mode addr_mode> void nes_cpu::TAS() { assert(false); }
+template<nes_addr_mode addr_mode> void nes_cpu::LAS() { assert(false); }
+
+#define OP_ENTRY_(op_code, op, mode, cycles, page_cross, official) \
+    { &nes_cpu::op<nes_addr_mode::nes_addr_mode_##mode>, #op, nes_addr_mode::nes_addr_mode_##mode, official },
+
+const nes_cpu::nes_op_entry nes_cpu::s_op_table[0x100] = { NES_OP_CODE_TABLE(OP_ENTRY_) };
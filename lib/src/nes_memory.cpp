@@ -10,10 +10,29 @@ void nes_memory::power_on(nes_system *system)
     _system = system;
     _ppu = _system->ppu();
     _input = _system->input();
+    _mapper = nullptr;
+    _prg_generation = 1;
+    _prg_rom_generation = 1;
+    _side_effect_count = 0;
+    _status_read_count = 0;
+    memset(_prg_banks, 0, sizeof(_prg_banks));
+    memset(_prg_slots, 0, sizeof(_prg_slots));
+    _write_mapper_reg = nullptr;
+
+    build_page_table();
 }
 
 uint8_t nes_memory::read_io_reg(uint16_t addr)
 {
+    // PPU registers - PPU needs to catch up first
+    if (addr < 0x4000)
+        _system->sync_ppu();
+
+    if (addr == 0x2002)
+        _status_read_count++;
+    else
+        _side_effect_count++;
+
     switch (addr)
     {
     case 0x2002: return _ppu->read_PPUSTATUS();
@@ -28,10 +47,15 @@ uint8_t nes_memory::read_io_reg(uint16_t addr)
 
 void nes_memory::write_io_reg(uint16_t addr, uint8_t val)
 {
+    // PPU registers - PPU needs to catch up first
+    if (addr < 0x4000)
+        _system->sync_ppu();
+
     switch (addr)
     {
-    case 0x2000: _ppu->write_PPUCTRL(val); return;
-    case 0x2001: _ppu->write_PPUMASK(val); return;
+    // Pattern table / rendering changes move A12 rises - see nes_ppu::a12_rise_dot
+    case 0x2000: _ppu->write_PPUCTRL(val); _system->reschedule(); return;
+    case 0x2001: _ppu->write_PPUMASK(val); _system->reschedule(); return;
     case 0x2003: _ppu->write_OAMADDR(val); return;
     case 0x2004: _ppu->write_OAMDATA(val); return;
     case 0x2005: _ppu->write_PPUSCROLL(val); return;
@@ -45,19 +69,96 @@ void nes_memory::write_io_reg(uint16_t addr, uint8_t val)
     _ppu->write_latch(val);
 }
 
-void nes_memory::load_mapper(nes_mapper *mapper)
+void nes_memory::sync_ppu()
+{
+    _system->sync_ppu();
+}
+
+void nes_memory::reschedule()
+{
+    _system->reschedule();
+}
+
+void nes_memory::load_mapper(nes_mapper *mapper, nes_mem_write_handler write_reg)
 {
     // unset previous mapper
     _mapper = nullptr;
+    _write_mapper_reg = write_reg;
+    _prg_generation++;
+    _prg_rom_generation++;
 
     // Give mapper a chance to copy all the bytes needed
     mapper->on_load_ram(*this);
 
     _mapper = mapper;
     _mapper->get_info(_mapper_info);
+
+    build_page_table();
 }
 
-void nes_memory::set_byte(uint16_t addr, uint8_t val)
+void nes_memory::build_page_table()
+{
+    for (int i = 0; i < PAGE_COUNT; ++i)
+    {
+        uint16_t addr = uint16_t(i * PAGE_SIZE);
+
+        // $0000~$1fff mirrors $0000~$07ff - resolve the mirror once here
+        redirect_addr(addr);
+        uint8_t *page = &_ram[0] + addr;
+
+        _read_pages[i] = page;
+        _write_pages[i] = page;
+        _read_handlers[i] = nullptr;
+        _write_handlers[i] = nullptr;
+
+        // $2000~$3fff and $4000~$40ff contain IO registers
+        if ((addr & 0xE000) == 0x2000 || (addr & 0xff00) == 0x4000)
+        {
+            _read_pages[i] = nullptr;
+            _write_pages[i] = nullptr;
+            _read_handlers[i] = &nes_memory::read_io_page;
+            _write_handlers[i] = &nes_memory::write_io_page;
+            continue;
+        }
+
+        // Mapped PRG ROM is read-only - writes go through write_mapper_page which drops them
+        if (addr >= PRG_ROM_START)
+        {
+            const uint8_t *bank = _prg_slots[(addr - PRG_ROM_START) / PRG_BANK_SIZE];
+            if (bank)
+                _read_pages[i] = bank + addr % PRG_BANK_SIZE;
+
+            _write_pages[i] = nullptr;
+            _write_handlers[i] = &nes_memory::write_mapper_page;
+        }
+
+        if (_mapper && (_mapper_info.flags & nes_mapper_flags_has_registers))
+        {
+            if (addr >= _mapper_info.reg_start && addr + PAGE_SIZE - 1 <= _mapper_info.reg_end)
+            {
+                // no need to check the range for every write
+                _write_pages[i] = nullptr;
+                _write_handlers[i] = _write_mapper_reg;
+            }
+            else if (addr + PAGE_SIZE - 1 >= _mapper_info.reg_start && addr <= _mapper_info.reg_end)
+            {
+                _write_pages[i] = nullptr;
+                _write_handlers[i] = &nes_memory::write_mapper_page;
+            }
+        }
+    }
+}
+
+uint8_t nes_memory::read_io_page(uint16_t addr)
+{
+    redirect_addr(addr);
+    if (is_io_reg(addr))
+        return read_io_reg(addr);
+
+    return _ram[addr];
+}
+
+void nes_memory::write_io_page(uint16_t addr, uint8_t val)
 {
     redirect_addr(addr);
     if (is_io_reg(addr))
@@ -66,13 +167,23 @@ void nes_memory::set_byte(uint16_t addr, uint8_t val)
         return;
     }
 
-    if (_mapper && (_mapper_info.flags & nes_mapper_flags_has_registers))
+    _ram[addr] = val;
+}
+
+void nes_memory::write_mapper_page(uint16_t addr, uint8_t val)
+{
+    if (_mapper && (_mapper_info.flags & nes_mapper_flags_has_registers) &&
+        addr >= _mapper_info.reg_start && addr <= _mapper_info.reg_end)
     {
-        if (addr >= _mapper_info.reg_start && addr <= _mapper_info.reg_end)
-        {
-            _mapper->write_reg(addr, val);
+        (this->*_write_mapper_reg)(addr, val);
+        return;
+    }
+
+    if (addr >= PRG_ROM_START)
+    {
+        // Mapped PRG ROM is read-only
+        if (_prg_slots[(addr - PRG_ROM_START) / PRG_BANK_SIZE])
             return;
-        }
     }
 
     _ram[addr] = val;
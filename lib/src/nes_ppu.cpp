@@ -3,6 +3,8 @@
 #include "nes_system.h"
 #include "nes_memory.h"
 
+#include <algorithm>
+
 nes_ppu_protect::nes_ppu_protect(nes_ppu *ppu)
 {
     _ppu = ppu;
@@ -34,12 +36,133 @@ void nes_ppu::oam_dma(uint16_t addr)
         _system->ram()->get_bytes(_oam.data() + _oam_addr, copy_before_wrap, addr, copy_before_wrap);
         _system->ram()->get_bytes(_oam.data(), PPU_OAM_SIZE - copy_before_wrap, addr + copy_before_wrap, PPU_OAM_SIZE - copy_before_wrap);
     }
+
+    _sprite_index_dirty = true;
 }
 
-void nes_ppu::load_mapper(nes_mapper *mapper)
+//
+// NES colors in RGB
+// http://wiki.nesdev.com/w/index.php/PPU_palettes
+//
+static const uint8_t s_nes_colors[PPU_COLOR_COUNT][3] =
+{
+    {  84,  84,  84 }, {   0,  30, 116 }, {   8,  16, 144 }, {  48,   0, 136 },
+    {  68,   0, 100 }, {  92,   0,  48 }, {  84,   4,   0 }, {  60,  24,   0 },
+    {  32,  42,   0 }, {   8,  58,   0 }, {   0,  64,   0 }, {   0,  60,   0 },
+    {   0,  50,  60 }, {   0,   0,   0 }, {   0,   0,   0 }, {   0,   0,   0 },
+    { 152, 150, 152 }, {   8,  76, 196 }, {  48,  50, 236 }, {  92,  30, 228 },
+    { 136,  20, 176 }, { 160,  20, 100 }, { 152,  34,  32 }, { 120,  60,   0 },
+    {  84,  90,   0 }, {  40, 114,   0 }, {   8, 124,   0 }, {   0, 118,  40 },
+    {   0, 102, 120 }, {   0,   0,   0 }, {   0,   0,   0 }, {   0,   0,   0 },
+    { 236, 238, 236 }, {  76, 154, 236 }, { 120, 124, 236 }, { 176,  98, 236 },
+    { 228,  84, 236 }, { 236,  88, 180 }, { 236, 106, 100 }, { 212, 136,  32 },
+    { 160, 170,   0 }, { 116, 196,   0 }, {  76, 208,  32 }, {  56, 204, 108 },
+    {  56, 180, 204 }, {  60,  60,  60 }, {   0,   0,   0 }, {   0,   0,   0 },
+    { 236, 238, 236 }, { 168, 204, 236 }, { 188, 188, 236 }, { 212, 178, 236 },
+    { 236, 174, 236 }, { 236, 174, 212 }, { 236, 180, 176 }, { 228, 196, 144 },
+    { 204, 210, 120 }, { 180, 222, 120 }, { 168, 226, 144 }, { 152, 226, 180 },
+    { 160, 214, 228 }, { 160, 162, 160 }, {   0,   0,   0 }, {   0,   0,   0 },
+};
+
+void nes_ppu::set_output(nes_pixel_format format, void *buffer_1, void *buffer_2, void *buffer_3, size_t pitch)
+{
+    _output_format = format;
+    _outputs[0] = (uint8_t *)buffer_1;
+    _outputs[1] = (uint8_t *)buffer_2;
+    _outputs[2] = (uint8_t *)buffer_3;
+    _output_pitch = pitch;
+
+    // Pick the pixel writer once rather than for every pixel
+    bool same_as_frame = (format == nes_pixel_format_indexed && pitch == PPU_SCREEN_X);
+    if (!buffer_1 || same_as_frame)
+        _set_output_pixel = nullptr;
+    else if (format == nes_pixel_format_argb8888)
+        _set_output_pixel = &nes_ppu::set_output_pixel<nes_pixel_format_argb8888>;
+    else if (format == nes_pixel_format_rgb565)
+        _set_output_pixel = &nes_ppu::set_output_pixel<nes_pixel_format_rgb565>;
+    else
+        _set_output_pixel = &nes_ppu::set_output_pixel<nes_pixel_format_indexed>;
+
+    _output = _set_output_pixel ? _outputs[_write_frame] : nullptr;
+
+    // Whoever sets output is going to consume frames
+    map_frame_buffers();
+    if (_frame_buffers[0] == _frame_buffers[1])
+        allocate_frame_buffers();
+
+    // Precompute host color for every emphasis x color combination - so that PPUMASK writes only need to
+    // look up 32 entries in update_palette
+    for (int emphasis = 0; emphasis < 8; ++emphasis)
+    {
+        for (int color = 0; color < PPU_COLOR_COUNT; ++color)
+        {
+            // Each emphasis bit (red / green / blue) darkens the other two components
+            int rgb[3];
+            for (int component = 0; component < 3; ++component)
+            {
+                rgb[component] = s_nes_colors[color][component];
+                for (int bit = 0; bit < 3; ++bit)
+                {
+                    if ((emphasis & (1 << bit)) && bit != component)
+                        rgb[component] = rgb[component] * 3 / 4;
+                }
+            }
+
+            uint32_t host_color;
+            if (format == nes_pixel_format_rgb565)
+                host_color = ((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3);
+            else
+                host_color = 0xff000000 | (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+
+            _output_colors[emphasis * PPU_COLOR_COUNT + color] = host_color;
+        }
+    }
+
+    update_palette();
+}
+
+void nes_ppu::allocate_frame_buffers()
+{
+    // The other buffers start out with the frame rendered so far, which is the latest one
+    for (int i = 1; i < PPU_FRAME_BUFFER_COUNT; ++i)
+    {
+        if (!_frame_storage[i])
+        {
+            _frame_storage[i].reset(new uint8_t[PPU_FRAME_SIZE]);
+            memcpy(_frame_storage[i].get(), _frame_storage[0].get(), PPU_FRAME_SIZE);
+        }
+    }
+
+    map_frame_buffers();
+}
+
+void nes_ppu::map_frame_buffers()
+{
+    // Host buffers in the same format and layout - render straight into them instead of writing every pixel twice
+    bool host = _outputs[0] && _output_format == nes_pixel_format_indexed && _output_pitch == PPU_SCREEN_X;
+
+    // PPU keeps rendering into the first storage so that nothing it has rendered so far moves
+    int storage = 1;
+    for (int i = 0; i < PPU_FRAME_BUFFER_COUNT; ++i)
+    {
+        if (host)
+            _frame_buffers[i] = _outputs[i];
+        else if (i == _write_frame || !_frame_storage[storage])
+            _frame_buffers[i] = _frame_storage[0].get();
+        else
+            _frame_buffers[i] = _frame_storage[storage++].get();
+    }
+
+    _frame_buffer = _frame_buffers[_write_frame];
+    _pixel_row = -1;
+}
+
+void nes_ppu::load_mapper(nes_mapper *mapper, nes_ppu_a12_rise_handler a12_rise, nes_ppu_a12_count_handler a12_count)
 {
     // unset previous mapper
     _mapper = nullptr;
+    _a12_rise = a12_rise;
+    _a12_rises_until_irq = a12_count;
 
     // Give mapper a chance to copy all the bytes needed
     mapper->on_load_ppu(*this);
@@ -53,7 +176,21 @@ void nes_ppu::load_mapper(nes_mapper *mapper)
 
 void nes_ppu::set_mirroring(nes_mapper_flags flags)
 {
-    _mirroring_flags = nes_mapper_flags(flags & nes_mapper_flags_mirroring_mask);
+    // Which physical name table each of $2000/$2400/$2800/$2c00 maps to - indexed by mirroring flags
+    static const uint8_t s_name_tables[4][PPU_NAME_TABLE_PAGE_COUNT] = {
+        { 0, 0, 0, 0 },     // one screen lower bank
+        { 1, 1, 1, 1 },     // one screen upper bank
+        { 0, 1, 0, 1 },     // vertical - $2000=$2800, $2400=$2c00
+        { 0, 0, 1, 1 },     // horizontal - $2000=$2400, $2800=$2c00
+    };
+
+    const uint8_t *name_tables = s_name_tables[flags & nes_mapper_flags_mirroring_mask];
+    for (int page = PPU_NAME_TABLE_ADDR / PPU_VRAM_PAGE_SIZE; page < PPU_VRAM_PAGE_COUNT; ++page)
+    {
+        // 0x3000~0x3eff mirrors to 0x2000~0x2eff
+        uint8_t *name_table = _name_table_ram + name_tables[page % PPU_NAME_TABLE_PAGE_COUNT] * PPU_VRAM_PAGE_SIZE;
+        _read_pages[page] = _write_pages[page] = name_table;
+    }
 }
 
 void nes_ppu::init()
@@ -71,6 +208,7 @@ void nes_ppu::init()
     _show_bg = false;
     _show_sprites = false;
     _gray_scale_mode = false;
+    _emphasis = 0;
 
     // PPUSTATUS
     _latch = 0;
@@ -103,14 +241,35 @@ void nes_ppu::init()
     _auto_stop = false;
 
     _mask_oam_read = false;
-    _frame_buffer = _frame_buffer_1;
-    memset(_frame_buffer_1, 0, sizeof(_frame_buffer_1));
-    memset(_frame_buffer_2, 0, sizeof(_frame_buffer_2));
-    memset(_frame_buffer_bg, 0, sizeof(_frame_buffer_bg));
+    if (!_frame_storage[0])
+        _frame_storage[0].reset(new uint8_t[PPU_FRAME_SIZE]);
+    for (auto &storage : _frame_storage)
+    {
+        if (storage)
+            memset(storage.get(), 0, PPU_FRAME_SIZE);
+    }
+    memset(_frame_sequences, 0, sizeof(_frame_sequences));
+    _write_frame = 0;
+    _latest_frame = 1;
+    _read_frame = 2;
+    _render = _render_frame = true;
+    _palette_dirty = false;
+    memset(_bg_opaque, 0, sizeof(_bg_opaque));
+    memset(_tile_cache_valid, 0, sizeof(_tile_cache_valid));
+
+    _output_format = nes_pixel_format_indexed;
+    _set_output_pixel = nullptr;
+    _output = nullptr;
+    memset(_outputs, 0, sizeof(_outputs));
+    _output_pitch = 0;
+    memset(_output_colors, 0, sizeof(_output_colors));
+    map_frame_buffers();
+    update_palette();
 
     _last_sprite_id = 0;
     _has_sprite_0 = 0;
     _mask_oam_read = 0;
+    _sprite_index_dirty = true;
 }
 
 void nes_ppu::reset()
@@ -122,10 +281,23 @@ void nes_ppu::power_on(nes_system *system)
 {
     NES_TRACE1("[NES_PPU] POWER ON");
 
+    memset(_chr_ram, 0, sizeof(_chr_ram));
+    memset(_name_table_ram, 0, sizeof(_name_table_ram));
+    memset(_palette_ram, 0, sizeof(_palette_ram));
+
     init();
 
+    // CHR RAM until mapper maps CHR ROM
+    for (int page = 0; page < PPU_PATTERN_TABLE_SIZE / PPU_VRAM_PAGE_SIZE; ++page)
+        _read_pages[page] = _write_pages[page] = _chr_ram + page * PPU_VRAM_PAGE_SIZE;
+    set_mirroring(nes_mapper_flags_horizontal_mirroring);
+
     _system = system;
 
+    _mapper = nullptr;
+    _a12_rise = nullptr;
+    _a12_rises_until_irq = nullptr;
+
     NES_TRACE3("[NES_PPU] SCANLINE " << std::dec << _cur_scanline << " ------ ");
 }
 
@@ -148,112 +320,178 @@ void nes_ppu::fetch_tile()
 
     auto data_access_cycle = scanline_render_cycle % 8;
 
-    // which of 8 rows witin a tile
-    uint8_t tile_row_index = (cur_scanline + _scroll_y) % 8;
-
     if (data_access_cycle == nes_ppu_cycle_t(0))
     {
-        // fetch nametable byte for current 8-pixel-tile
-        // http://wiki.nesdev.com/w/index.php/PPU_nametables
-        uint16_t name_tbl_addr = (_ppu_addr & 0xfff) | 0x2000;
-        _tile_index = read_byte(name_tbl_addr);
+        fetch_name_table_byte();
     }
     else if (data_access_cycle == nes_ppu_cycle_t(2))
     {
-        // fetch attribute table byte
-        // each attribute pixel is 4 quadrant of 2x2 tile (so total of 8x8) tile
-        // the result color byte is 2-bit (bit 3/2) for each quadrant
-        // http://wiki.nesdev.com/w/index.php/PPU_attribute_tables
-        // http://wiki.nesdev.com/w/index.php/PPU_scrolling#Wrapping_around
-        uint8_t tile_column = _ppu_addr & 0x1f;         // YY YYYX XXXX = 1 1111
-        uint8_t tile_row = (_ppu_addr & 0x3e0) >> 5;    // YY YYYX XXXX = 11 1110 0000
-        uint8_t tile_attr_column = (tile_column >> 2) & 0x7;
-        uint8_t tile_attr_row = (tile_row >> 2) & 0x7;
-        uint16_t attr_tbl_addr = 0x23c0 | (_ppu_addr & 0x0c00) | (tile_attr_row << 3) | tile_attr_column;
-        uint8_t color_byte = read_byte(attr_tbl_addr);
-
-        // each quadrant has 2x2 tile and each row/column has 4 tiles, so divide by 2 (& 0x2 is faster)
-        uint8_t _quadrant_id = (tile_row & 0x2) + ((tile_column & 0x2) >> 1);
-        uint8_t color_bit32 = (color_byte & (0x3 << (_quadrant_id * 2))) >> (_quadrant_id * 2);
-        _tile_palette_bit32 = color_bit32 << 2;
+        fetch_attribute_byte();
     }
     else if (data_access_cycle == nes_ppu_cycle_t(4))
     {
-        // Pattern table is area of memory define all the tiles make up background and sprites.
-        // Think it as "lego blocks" that you can build up your background and sprites which
-        // simply consists of indexes. It is quite convoluted by today's standards but it is
-        // just a space saving technique.
-        // http://wiki.nesdev.com/w/index.php/PPU_pattern_tables
-        _bitplane0 = read_pattern_table_column(/* sprite = */false, _tile_index, /* bitplane = */ 0, tile_row_index);
+        fetch_pattern_row(cur_scanline);
     }
     else if (data_access_cycle == nes_ppu_cycle_t(6))
     {
-        // fetch tilebitmap high
-        // add one more cycle for memory access to skip directly to next access
-        uint8_t bitplane1 = read_pattern_table_column(/* sprite = */false, _tile_index, /* bitplane = */ 1, tile_row_index);
+        int tile = (int)(scanline_render_cycle.count() - /* current_access_cycle */ 6) / 8;
+        render_tile(tile, cur_scanline);
+    }
+}
 
-        // for each column - bitplane0/bitplane1 has entire 8 column
-        // high bit -> low bit
-        int start_bit = 7;
-        int end_bit = 0;
+// fetch all 4 bytes of tile and render it, all at once
+void nes_ppu::fetch_tile(int tile, uint16_t cur_scanline)
+{
+    fetch_name_table_byte();
+    fetch_attribute_byte();
+    fetch_pattern_row(cur_scanline);
+    render_tile(tile, cur_scanline);
+}
 
-        int tile = (int)(scanline_render_cycle.count() - /* current_access_cycle */ 6) / 8;
-        if (_fine_x_scroll > 0)
+void nes_ppu::fetch_name_table_byte()
+{
+    // fetch nametable byte for current 8-pixel-tile
+    // http://wiki.nesdev.com/w/index.php/PPU_nametables
+    uint16_t name_tbl_addr = (_ppu_addr & 0xfff) | 0x2000;
+    _tile_index = read_name_table_byte(name_tbl_addr);
+}
+
+void nes_ppu::fetch_attribute_byte()
+{
+    // fetch attribute table byte
+    // each attribute pixel is 4 quadrant of 2x2 tile (so total of 8x8) tile
+    // the result color byte is 2-bit (bit 3/2) for each quadrant
+    // http://wiki.nesdev.com/w/index.php/PPU_attribute_tables
+    // http://wiki.nesdev.com/w/index.php/PPU_scrolling#Wrapping_around
+    uint8_t tile_column = _ppu_addr & 0x1f;         // YY YYYX XXXX = 1 1111
+    uint8_t tile_row = (_ppu_addr & 0x3e0) >> 5;    // YY YYYX XXXX = 11 1110 0000
+    uint8_t tile_attr_column = (tile_column >> 2) & 0x7;
+    uint8_t tile_attr_row = (tile_row >> 2) & 0x7;
+    uint16_t attr_tbl_addr = 0x23c0 | (_ppu_addr & 0x0c00) | (tile_attr_row << 3) | tile_attr_column;
+    uint8_t color_byte = read_name_table_byte(attr_tbl_addr);
+
+    // each quadrant has 2x2 tile and each row/column has 4 tiles, so divide by 2 (& 0x2 is faster)
+    uint8_t _quadrant_id = (tile_row & 0x2) + ((tile_column & 0x2) >> 1);
+    uint8_t color_bit32 = (color_byte & (0x3 << (_quadrant_id * 2))) >> (_quadrant_id * 2);
+    _tile_palette_bit32 = color_bit32 << 2;
+}
+
+void nes_ppu::fetch_pattern_row(uint16_t cur_scanline)
+{
+    // which of 8 rows witin a tile
+    uint8_t tile_row_index = (cur_scanline + _scroll_y) % 8;
+
+    // Pattern table is area of memory define all the tiles make up background and sprites.
+    // Think it as "lego blocks" that you can build up your background and sprites which
+    // simply consists of indexes. It is quite convoluted by today's standards but it is
+    // just a space saving technique.
+    // http://wiki.nesdev.com/w/index.php/PPU_pattern_tables
+    // Both bitplanes come from the decoded tile cache at once
+    _tile_row = read_pattern_row(get_pattern_row_addr(/* sprite = */false, _tile_index, tile_row_index), /* horizontal_flip = */ false);
+}
+
+void nes_ppu::render_tile(int tile, uint16_t cur_scanline)
+{
+    // for each column - _tile_row has entire 8 column
+    // high bit -> low bit
+    int start_bit = 7;
+    int end_bit = 0;
+
+    if (_fine_x_scroll > 0)
+    {
+        if (tile == 0)
         {
-            if (tile == 0)
-            {
-                start_bit = 7 - _fine_x_scroll;
-            }
-            else if (tile == 32)
-            {
-                // last tile
-                end_bit = 7 - _fine_x_scroll + 1;
-            }
-            else if (tile > 32)
-            {
-                // no need to render more than 33 tiles
-                // otherwise you'll see wrapped tiles in the begining of next line
-                return;
-            }
+            start_bit = 7 - _fine_x_scroll;
         }
-        else
+        else if (tile == 32)
         {
-            // We render exactly 32 tiles
-            if (tile > 31) return;
+            // last tile
+            end_bit = 7 - _fine_x_scroll + 1;
         }
-
-        for (int i = start_bit; i >= end_bit; --i)
+        else if (tile > 32)
         {
-            uint8_t column_mask = 1 << i;
-            uint8_t tile_palette_bit01 = ((_bitplane0 & column_mask) >> i) | ((bitplane1 & column_mask) >> i << 1);
-            uint8_t color_4_bit = _tile_palette_bit32 | tile_palette_bit01;
+            // no need to render more than 33 tiles
+            // otherwise you'll see wrapped tiles in the begining of next line
+            return;
+        }
+    }
+    else
+    {
+        // We render exactly 32 tiles
+        if (tile > 31) return;
+    }
 
-            _pixel_cycle[i] = get_palette_color(/* is_background = */ true, color_4_bit);
+    select_pixel_row(cur_scanline);
+    for (int i = start_bit; i >= end_bit; --i)
+    {
+        uint8_t tile_palette_bit01 = _tile_row[7 - i];
+        uint8_t color_4_bit = _tile_palette_bit32 | tile_palette_bit01;
 
-            uint16_t frame_addr = uint16_t(cur_scanline) * PPU_SCREEN_X + _x_offset++;
-            if (frame_addr >= sizeof(_frame_buffer_1))
-                continue;
-            _frame_buffer[frame_addr] = _pixel_cycle[i];
+        uint8_t x = _x_offset++;
+        set_pixel(x, get_palette_index(/* is_background = */ true, color_4_bit));
 
-            // record the palette index just for sprite 0 hit detection
-            // the detection use palette 0 instead of actual color
-            _frame_buffer_bg[frame_addr] = tile_palette_bit01;
-        }
+        // record whether it is palette 0 just for sprite 0 hit detection
+        // the detection use palette 0 instead of actual color
+        uint64_t &bits = _bg_opaque[cur_scanline & 1][x / 64];
+        uint64_t bit = 1ull << (x % 64);
+        bits = tile_palette_bit01 ? (bits | bit) : (bits & ~bit);
+    }
+
+    increment_x();
+}
+
+void nes_ppu::increment_x()
+{
+    if ((_ppu_addr & 0x1f) == 0x1f)
+    {
+        // Wrap to the next name table
+        _ppu_addr &= ~0x1f;
+        _ppu_addr ^= 0x0400;
+    }
+    else
+    {
+        _ppu_addr++;
+    }
+}
+
+void nes_ppu::increment_y()
+{
+    if ((_ppu_addr & 0x7000) != 0x7000)
+    {
+        // Increase fine Y position (within tile)
+        _ppu_addr += 0x1000;
+    }
+    else
+    {
+        _ppu_addr &= ~0x7000;
 
-        // Increment X position
-        if ((_ppu_addr & 0x1f) == 0x1f)
+        // == row 29?
+        if ((_ppu_addr & 0x3e0) != 0x3a0)
         {
-            // Wrap to the next name table
-            _ppu_addr &= ~0x1f;
-            _ppu_addr ^= 0x0400;
+             // Increase coarse Y position (next tile)
+            _ppu_addr += 0x20;
         }
         else
         {
-            _ppu_addr++;
+            // wrap around
+            _ppu_addr &= ~0x3e0;
+
+            // switch to another vertical name table
+            _ppu_addr ^= 0x0800;
         }
     }
 }
 
+void nes_ppu::reset_x()
+{
+    // Reset horizontal position
+    // This includes resetting horizontal name table (2000~2400, 2800~2c00)
+    // NNYY YYYX XXXX
+    //  ^      ^ ^^^^
+    _ppu_addr = (_ppu_addr & 0xfbe0) | (_temp_ppu_addr & ~0xfbe0);
+    _x_offset = 0;
+}
+
 void nes_ppu::fetch_tile_pipeline()
 {
     // No need to fetch anything if rendering is off
@@ -267,44 +505,12 @@ void nes_ppu::fetch_tile_pipeline()
         fetch_tile();
 
         if (_scanline_cycle == nes_ppu_cycle_t(256))
-        {
-            if ((_ppu_addr & 0x7000) != 0x7000)
-            {
-                // Increase fine Y position (within tile)
-                _ppu_addr += 0x1000;
-            }
-            else
-            {
-                _ppu_addr &= ~0x7000;
-
-                // == row 29?
-                if ((_ppu_addr & 0x3e0) != 0x3a0)
-                {
-                     // Increase coarse Y position (next tile)
-                    _ppu_addr += 0x20;
-                }
-                else
-                {
-                    // wrap around
-                    _ppu_addr &= ~0x3e0;
-
-                    // switch to another vertical name table
-                    _ppu_addr ^= 0x0800;
-                }
-            }
-        }
+            increment_y();
     }
     else if (_scanline_cycle < nes_ppu_cycle_t(321))
     {
         if (_scanline_cycle == nes_ppu_cycle_t(257))
-        {
-            // Reset horizontal position
-            // This includes resetting horizontal name table (2000~2400, 2800~2c00)
-            // NNYY YYYX XXXX
-            //  ^      ^ ^^^^
-            _ppu_addr = (_ppu_addr & 0xfbe0) | (_temp_ppu_addr & ~0xfbe0);
-            _x_offset = 0;
-        }
+            reset_x();
 
         // fetch tile data for sprites on the next scanline
     }
@@ -331,10 +537,7 @@ void nes_ppu::fetch_sprite_pipeline()
     // @TODO - Sprite 0 hit testing
     if (_scanline_cycle == nes_ppu_cycle_t(0))
     {
-        _last_sprite_id = 0;
-        _has_sprite_0 = false;
-        memset(_sprite_buf, 0xff, sizeof(_sprite_buf));
-        _sprite_overflow = false;
+        clear_sprite_buf();
     }
     else if (_scanline_cycle < nes_ppu_cycle_t(65))
     {
@@ -364,17 +567,7 @@ void nes_ppu::fetch_sprite_pipeline()
         if ((_scanline_cycle.count() % 2) == 0)
         {
             // even cycle - write to secondary OAM
-            // if in range
-            if (_sprite_pos_y + 1 <= _cur_scanline && _cur_scanline < _sprite_pos_y + 1 + _sprite_height)
-            {
-                if (sprite_id == 0)
-                    _has_sprite_0 = true;
-
-                if (_last_sprite_id >= PPU_ACTIVE_SPRITE_MAX)
-                    _sprite_overflow = true;
-                else
-                    _sprite_buf[_last_sprite_id++] = *get_sprite(sprite_id);
-            }
+            evaluate_sprite(sprite_id);
         }
         else
         {
@@ -398,6 +591,222 @@ void nes_ppu::fetch_sprite_pipeline()
     }
 }
 
+//
+// Bitplane -> pixel expansion
+// Spreads the 8 bits of a bitplane into 8 bytes, one per pixel (high bit -> low bit is left -> right), so that
+// the two bitplanes of a tile row become 8 2-bit palette indices with one shift and one OR on 64-bit integers
+// Each byte is either 0 or 1 before the shift, so this works regardless of host byte order
+//
+struct nes_bitplane_spread_table
+{
+    constexpr nes_bitplane_spread_table() : spread(), reversed()
+    {
+        for (int i = 0; i < 0x100; ++i)
+        {
+            for (int x = 0; x < 8; ++x)
+            {
+                spread[i][x] = (i >> (7 - x)) & 1;
+                reversed[i] |= ((i >> x) & 1) << (7 - x);
+            }
+        }
+    }
+
+    uint8_t spread[0x100][8];
+    uint8_t reversed[0x100];        // bits in reverse order - for horizontal flip
+};
+
+static constexpr nes_bitplane_spread_table s_bitplane_spread;
+
+static inline uint64_t expand_bitplanes(uint8_t bitplane0, uint8_t bitplane1)
+{
+    uint64_t pixels0, pixels1;
+    memcpy(&pixels0, s_bitplane_spread.spread[bitplane0], sizeof(pixels0));
+    memcpy(&pixels1, s_bitplane_spread.spread[bitplane1], sizeof(pixels1));
+    return pixels0 | (pixels1 << 1);
+}
+
+// Bit x set if pixel x of a decoded row isn't palette 0 - gathers bit 0 of the 8 bytes into one byte
+static inline uint8_t get_opaque_pixels(const uint8_t *pixels)
+{
+    uint64_t row;
+    memcpy(&row, pixels, sizeof(row));
+    uint64_t opaque = (row | (row >> 1)) & 0x0101010101010101ull;
+    return uint8_t((opaque * 0x0102040810204080ull) >> 56);
+}
+
+void nes_ppu::decode_tile(uint16_t tile)
+{
+    uint16_t tile_addr = tile << 4;
+    const uint8_t *tile_data = _read_pages[tile_addr / PPU_VRAM_PAGE_SIZE] + tile_addr % PPU_VRAM_PAGE_SIZE;
+    for (int row = 0; row < 8; ++row)
+    {
+        uint8_t bitplane0 = tile_data[row];
+        uint8_t bitplane1 = tile_data[row + 8];
+
+        // 8 pixels at a time - flipped row is simply the same expansion of bit-reversed bitplanes
+        uint64_t pixels = expand_bitplanes(bitplane0, bitplane1);
+        uint64_t flipped_pixels = expand_bitplanes(s_bitplane_spread.reversed[bitplane0], s_bitplane_spread.reversed[bitplane1]);
+        memcpy(_tile_cache[tile][0][row], &pixels, sizeof(pixels));
+        memcpy(_tile_cache[tile][1][row], &flipped_pixels, sizeof(flipped_pixels));
+    }
+
+    _tile_cache_valid[tile] = true;
+}
+
+void nes_ppu::clear_sprite_buf()
+{
+    _last_sprite_id = 0;
+    _has_sprite_0 = false;
+    memset(_sprite_buf, 0xff, sizeof(_sprite_buf));
+    _sprite_overflow = false;
+}
+
+void nes_ppu::evaluate_sprite(uint8_t sprite_id)
+{
+    // write to secondary OAM if in range
+    if (_sprite_pos_y + 1 <= _cur_scanline && _cur_scanline < _sprite_pos_y + 1 + _sprite_height)
+    {
+        if (sprite_id == 0)
+            _has_sprite_0 = true;
+
+        if (_last_sprite_id >= PPU_ACTIVE_SPRITE_MAX)
+            _sprite_overflow = true;
+        else
+            _sprite_buf[_last_sprite_id++] = *get_sprite(sprite_id);
+    }
+}
+
+//
+// Bucket all 64 sprites by the scanlines they cover - OAM usually only changes once per frame (OAMDMA), so this
+// is a lot cheaper than checking all 64 sprites against every single scanline
+//
+void nes_ppu::build_sprite_index()
+{
+    memset(_sprite_lines, 0, sizeof(_sprite_lines));
+
+    // In OAM order so that each line keeps the first 8 sprites, just like evaluate_sprite
+    for (uint8_t sprite_id = 0; sprite_id < PPU_SPRITE_MAX; ++sprite_id)
+    {
+        // Y is off by 1
+        int top = get_sprite(sprite_id)->pos_y + 1;
+        int bottom = min(top + _sprite_height, PPU_SCREEN_Y);
+        for (int line = top; line < bottom; ++line)
+        {
+            sprite_line &sprites = _sprite_lines[line];
+            if (sprites.count < PPU_ACTIVE_SPRITE_MAX)
+                sprites.sprite_ids[sprites.count] = sprite_id;
+            sprites.count++;
+        }
+    }
+
+    _sprite_index_dirty = false;
+}
+
+// Same as evaluate_sprite for all 64 sprites, using the sprite index
+void nes_ppu::evaluate_sprites()
+{
+    if (_sprite_index_dirty)
+        build_sprite_index();
+
+    const sprite_line &sprites = _sprite_lines[_cur_scanline];
+
+    _has_sprite_0 = (sprites.count > 0 && sprites.sprite_ids[0] == 0);
+    _sprite_overflow = (sprites.count > PPU_ACTIVE_SPRITE_MAX);
+    _last_sprite_id = min(sprites.count, uint8_t(PPU_ACTIVE_SPRITE_MAX));
+    for (uint8_t i = 0; i < _last_sprite_id; ++i)
+        _sprite_buf[i] = *get_sprite(sprites.sprite_ids[i]);
+}
+
+//
+// Render the entire scanline (cycle 0~340) in one go
+// This runs the same steps as fetch_tile_pipeline / fetch_sprite_pipeline in the same order, just without
+// going through every single dot - so it is only correct if nothing changes PPU state in the middle of the line
+//
+void nes_ppu::render_scanline()
+{
+    if (!_render_frame)
+    {
+        skip_scanline();
+        return;
+    }
+
+    bool render_sprites = _show_sprites && _cur_scanline != 0;
+
+    // cycle 0~256: sprite evaluation for this line
+    if (render_sprites)
+    {
+        clear_sprite_buf();
+        evaluate_sprites();
+        _mask_oam_read = false;
+    }
+
+    // cycle 1~256: tile 2~33 (tile 0 and 1 are prefetched in last line), cycle 257: reset X
+    if (_show_bg)
+    {
+        for (int tile = 2; tile < 34; ++tile)
+            fetch_tile(tile, _cur_scanline);
+
+        increment_y();
+        reset_x();
+    }
+
+    // cycle 257~320: sprites on top of the background
+    if (render_sprites)
+    {
+        for (uint8_t sprite_id = 0; sprite_id < _last_sprite_id; ++sprite_id)
+            fetch_sprite(sprite_id);
+    }
+
+    // cycle 321~336: prefetch tile 0 and 1 for next line
+    if (_show_bg)
+    {
+        uint16_t next_scanline = (_cur_scanline + 1) % PPU_SCREEN_Y;
+        fetch_tile(0, next_scanline);
+        fetch_tile(1, next_scanline);
+    }
+}
+
+void nes_ppu::skip_scanline()
+{
+    bool render_sprites = _show_sprites && _cur_scanline != 0;
+
+    // Sprite overflow needs the evaluation for every line
+    if (render_sprites)
+    {
+        clear_sprite_buf();
+        evaluate_sprites();
+        _mask_oam_read = false;
+    }
+
+    // Only sprite 0 has anything observable (the hit) - and only until it happens
+    bool check_sprite_0 = render_sprites && _has_sprite_0 && !_sprite_0_hit;
+
+    if (_show_bg)
+    {
+        if (check_sprite_0)
+        {
+            // background opacity is needed for the hit
+            for (int tile = 2; tile < 34; ++tile)
+                fetch_tile(tile, _cur_scanline);
+        }
+
+        // X position within the line doesn't matter as reset_x starts over
+        increment_y();
+        reset_x();
+    }
+
+    if (check_sprite_0)
+        fetch_sprite(0);
+
+    if (_show_bg)
+    {
+        // Prefetch the first 2 tiles of next line as usual since it is cheap and keeps _bg_opaque complete
+        uint16_t next_scanline = (_cur_scanline + 1) % PPU_SCREEN_Y;
+        fetch_tile(0, next_scanline);
+        fetch_tile(1, next_scanline);
+    }
+}
+
 void nes_ppu::fetch_sprite(uint8_t sprite_id)
 {
     assert(sprite_id < PPU_ACTIVE_SPRITE_MAX);
@@ -410,70 +819,49 @@ void nes_ppu::fetch_sprite(uint8_t sprite_id)
     if (sprite->attr & PPU_SPRITE_ATTR_VERTICAL_FLIP)
         tile_row_index = _sprite_height - 1 - tile_row_index;
 
-    uint8_t bitplane0, bitplane1;
+    uint16_t row_addr;
     if (_use_8x16_sprite)
-    {
-        bitplane0 = read_pattern_table_column_8x16_sprite(tile_index, 0, tile_row_index);
-        bitplane1 = read_pattern_table_column_8x16_sprite(tile_index, 1, tile_row_index);
-    }
+        row_addr = get_pattern_row_addr_8x16_sprite(tile_index, tile_row_index);
     else
-    {
-        bitplane0 = read_pattern_table_column(/* sprite = */ true, tile_index, 0, tile_row_index);
-        bitplane1 = read_pattern_table_column(/* sprite = */ true, tile_index, 1, tile_row_index);
-    }
+        row_addr = get_pattern_row_addr(/* sprite = */ true, tile_index, tile_row_index);
+
+    // pixels are already in screen order - flipped or not
+    const uint8_t *pixels = read_pattern_row(row_addr, sprite->attr & PPU_SPRITE_ATTR_HORIZONTAL_FLIP);
 
     // bit3/2 is shared for the entire sprite (just like background attribute table)
     uint8_t palette_index_bit32 = (sprite->attr & PPU_SPRITE_ATTR_BIT32_MASK) << 2;
 
-    // loop all bits - high -> low
-    for (int i = 7; i >= 0; --i)
-    {
-        uint8_t column_mask = 1 << i;
-        uint8_t palette_index_bit01 = ((bitplane1 & column_mask) >> i << 1) | ((bitplane0 & column_mask) >> i);
-
-        // palette 0 is always background
-        if (palette_index_bit01 == 0)
-            continue;
-
-        uint8_t palette_index = palette_index_bit32 | palette_index_bit01;
-
-        uint8_t color = get_palette_color(/* is_background = */false, palette_index);
-        uint16_t frame_addr = _cur_scanline * PPU_SCREEN_X + sprite->pos_x;
-        if (sprite->attr & PPU_SPRITE_ATTR_HORIZONTAL_FLIP)
-            frame_addr += i;     // low -> high in horizontal flip
-        else
-            frame_addr += 7 - i; // high -> low as usual
+    // opaque pixels as bit 0~7 - anything past the right edge of the screen is not drawn
+    uint8_t sprite_opaque = get_opaque_pixels(pixels);
+    if (sprite->pos_x > PPU_SCREEN_X - 8)
+        sprite_opaque &= (1 << (PPU_SCREEN_X - sprite->pos_x)) - 1;
 
-        if (frame_addr >= sizeof(_frame_buffer_1))
+    bool is_sprite_0 = (_has_sprite_0 && sprite_id == 0);
+    bool behind_bg = sprite->attr & PPU_SPRITE_ATTR_BEHIND_BG;
+    if (behind_bg || is_sprite_0)
+    {
+        // use the recorded background opacity for sprite 0 hit detection - all 8 pixels at once
+        // don't use the actual color as some times game use all 0f 'black' palette to black out screen
+        uint8_t overlap = sprite_opaque & get_bg_opaque(_cur_scanline, sprite->pos_x);
+        if (overlap && is_sprite_0)
         {
-            // part of the sprite might be over
-            continue;
+            // sprite 0 hit detection
+            _sprite_0_hit = true;
         }
 
-        bool is_sprite_0 = (_has_sprite_0 && sprite_id == 0);
-        bool behind_bg = sprite->attr & PPU_SPRITE_ATTR_BEHIND_BG;
-        if (behind_bg || is_sprite_0)
+        if (behind_bg)
         {
-            // use the recorded 2-bit palette index for sprite 0 hit detection
-            // don't use the actual color as some times game use all 0f 'black' palette to black out screen
-            bool overlap = (_frame_buffer_bg[frame_addr] != 0);
-            if (overlap)
-            {
-                if (is_sprite_0)
-                {
-                    // sprite 0 hit detection
-                    _sprite_0_hit = true;
-                }
-
-                if (behind_bg)
-                {
-                    // behind background
-                    continue;
-                }
-             }
+            // behind background
+            sprite_opaque &= ~overlap;
         }
+    }
 
-        _frame_buffer[frame_addr] = color;
+    // loop all pixels - left -> right
+    select_pixel_row(_cur_scanline);
+    for (int x = 0; x < 8; ++x)
+    {
+        if (sprite_opaque & (1 << x))
+            set_pixel(uint8_t(sprite->pos_x + x), get_palette_index(/* is_background = */false, palette_index_bit32 | pixels[x]));
     }
 }
 
@@ -481,8 +869,44 @@ void nes_ppu::step_to(nes_cycle_t count)
 {
     while (_master_cycle < count && !_system->stop_requested())
     {
+        // Fast path - the entire next visible line (1~239) is before count, which means CPU can't have accessed
+        // any PPU register (they always catch up PPU first) or switched banks in the middle of it
+        if (_scanline_cycle == nes_ppu_cycle_t(340) && _cur_scanline < PPU_SCREEN_Y - 1 &&
+            count - _master_cycle >= PPU_SCANLINE_CYCLE)
+        {
+            step_ppu(nes_ppu_cycle_t(1));
+            render_scanline();
+
+            // The A12 rise is somewhere in this line - already in the past by the time CPU can observe it
+            if (_a12_rise && a12_rise_dot() >= 0)
+                (this->*_a12_rise)();
+
+            step_ppu(PPU_SCANLINE_CYCLE - nes_ppu_cycle_t(1));
+            continue;
+        }
+
+        // Fast path - PPU isn't drawing (vblank / pre-render line, or rendering is off) so no dot does anything
+        // until the next event. Jump right before it (or to count) and let the dot loop below handle the event
+        if (is_render_off() || _cur_scanline >= PPU_SCREEN_Y)
+        {
+            int64_t skip = min(cycles_until_idle_event() - 1, (count - _master_cycle).count());
+            if (skip > 0)
+            {
+                while (skip > 0)
+                {
+                    int64_t cycles = min(skip, PPU_SCANLINE_CYCLE.count() - 1);
+                    step_ppu(nes_ppu_cycle_t(cycles));
+                    skip -= cycles;
+                }
+                continue;
+            }
+        }
+
         step_ppu(nes_ppu_cycle_t(1));
 
+        if (_a12_rise && _scanline_cycle == nes_ppu_cycle_t(a12_rise_dot()) && is_a12_rise_scanline(_cur_scanline))
+            (this->*_a12_rise)();
+
         if (_cur_scanline <= 239)
         {
             fetch_tile_pipeline();
@@ -541,6 +965,104 @@ void nes_ppu::step_to(nes_cycle_t count)
     }
 }
 
+int64_t nes_ppu::cycles_until(int64_t pos, int scanline, int scanline_cycle)
+{
+    // Note that the odd frame skip still advances _master_cycle so it doesn't change the distances
+    int64_t target = scanline * PPU_SCANLINE_CYCLE.count() + scanline_cycle;
+
+    return (target > pos) ? target - pos : target - pos + PPU_FRAME_CYCLE;
+}
+
+int64_t nes_ppu::cycles_until_idle_event()
+{
+    // Every dot that does something when PPU isn't drawing - see step_to
+    // Frame end is always preceded by 261/340 so it is never skipped over
+    int64_t pos = frame_pos();
+    int64_t next = min({
+        cycles_until(pos, 241, 1),      // VBlank begin / NMI
+        cycles_until(pos, 260, 330),    // VBlank race @HACK
+        cycles_until(pos, 261, 0),      // VBlank end
+        cycles_until(pos, 261, 1),      // clear sprite 0 hit
+        cycles_until(pos, 261, 340),    // odd frame skip
+    });
+
+    // A12 rise on pre-render line
+    int a12_dot = a12_rise_dot();
+    if (_a12_rise && a12_dot >= 0)
+        next = min(next, cycles_until(pos, PPU_SCANLINE_COUNT - 1, a12_dot));
+
+    return next;
+}
+
+int64_t nes_ppu::cycles_until_irq()
+{
+    if (!_a12_rises_until_irq)
+        return -1;
+
+    int rises = (this->*_a12_rises_until_irq)();
+    int a12_dot = a12_rise_dot();
+    if (rises <= 0 || a12_dot < 0)
+        return -1;
+
+    // Walk the scanlines from here, counting the ones with a rise still ahead of us - scanline goes past the
+    // end of frame so that the distance keeps growing. A frame has 241 rises so this is at most 2 frames
+    int64_t pos = frame_pos();
+    int scanline = _cur_scanline;
+    if (_scanline_cycle.count() >= a12_dot)
+        scanline++;
+
+    for (;; ++scanline)
+    {
+        if (is_a12_rise_scanline(scanline % PPU_SCANLINE_COUNT) && --rises == 0)
+            return scanline * PPU_SCANLINE_CYCLE.count() + a12_dot - pos;
+    }
+}
+
+nes_cycle_t nes_ppu::next_event_cycle()
+{
+    // Only VBlank NMI, mapper IRQ and end of frame (swap buffer / auto stop) matter here
+    // Everything else (VBlank flag, sprite 0 hit, etc) can only be observed through PPU registers, which
+    // always catch up PPU before the access
+    int64_t pos = frame_pos();
+    int64_t to_vblank = cycles_until(pos, 241, 1);
+    int64_t to_frame_end = cycles_until(pos, 0, 0);
+    int64_t next = min(to_vblank, to_frame_end);
+
+    int64_t to_irq = cycles_until_irq();
+    if (to_irq > 0)
+        next = min(next, to_irq);
+
+    return _master_cycle + nes_cycle_t(next);
+}
+
+nes_cycle_t nes_ppu::next_status_change_cycle(nes_cycle_t since)
+{
+    // since can be a bit behind or ahead of PPU - but never a full frame
+    int64_t pos = (frame_pos() + (since - _master_cycle).count()) % PPU_FRAME_CYCLE;
+    if (pos < 0)
+        pos += PPU_FRAME_CYCLE;
+
+    // Sprite evaluation can set/clear sprite overflow and sprite 0 hit anywhere in the visible scanlines
+    if (_show_sprites && pos < PPU_SCREEN_Y * PPU_SCANLINE_CYCLE.count())
+        return since;
+
+    // VBlank begin, VBlank end (including the early clear @HACK in step_to), and sprite 0 hit clear
+    int64_t next = min(min(cycles_until(pos, 241, 1), cycles_until(pos, 260, 330)),
+                       min(cycles_until(pos, 261, 0), cycles_until(pos, 261, 1)));
+
+    return since + nes_cycle_t(next);
+}
+
+void nes_ppu::end_frame()
+{
+    if (_render_frame)
+        swap_buffer();
+
+    _render_frame = _render;
+    if (_render_frame && _palette_dirty)
+        update_palette();
+}
+
 void nes_ppu::step_ppu(nes_ppu_cycle_t count)
 {
     assert(count < PPU_SCANLINE_CYCLE);
@@ -555,7 +1077,7 @@ void nes_ppu::step_ppu(nes_ppu_cycle_t count)
         if (_cur_scanline >= PPU_SCANLINE_COUNT)
         {
             _cur_scanline %= PPU_SCANLINE_COUNT;
-            swap_buffer();
+            end_frame();
             _frame_count++;
             NES_TRACE4("[NES_PPU] FRAME " << std::dec << _frame_count << " ------ ");
 
@@ -0,0 +1,124 @@
+#include "nes_rom.h"
+#include "nes_trace.h"
+
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define NES_ROM_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#if NES_ROM_MMAP
+
+// Identifies one version of one file - a file replaced or modified in place gets a new mapping
+typedef tuple<dev_t, ino_t, off_t, time_t> nes_rom_file_id;
+
+// Mappings currently in use by anyone - see nes_rom::open
+static mutex s_mappings_lock;
+static map<nes_rom_file_id, weak_ptr<nes_rom>> s_mappings;
+
+shared_ptr<nes_rom> nes_rom::map(const char *path)
+{
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    shared_ptr<nes_rom> rom;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        nes_rom_file_id id(st.st_dev, st.st_ino, st.st_size, st.st_mtime);
+
+        lock_guard<mutex> lock(s_mappings_lock);
+        rom = s_mappings[id].lock();
+        if (!rom)
+        {
+            void *data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                rom = shared_ptr<nes_rom>(new nes_rom());
+                rom->_data = (const uint8_t *)data;
+                rom->_size = size_t(st.st_size);
+                rom->_mapped = true;
+
+                // Drop the mappings nobody uses anymore while we are at it
+                for (auto it = s_mappings.begin(); it != s_mappings.end();)
+                {
+                    if (it->second.expired())
+                        it = s_mappings.erase(it);
+                    else
+                        ++it;
+                }
+
+                s_mappings[id] = rom;
+            }
+        }
+    }
+
+    close(fd);
+    return rom;
+}
+
+#else
+
+shared_ptr<nes_rom> nes_rom::map(const char *path)
+{
+    return nullptr;
+}
+
+#endif
+
+shared_ptr<nes_rom> nes_rom::open(const char *path)
+{
+    auto rom = map(path);
+    if (rom)
+    {
+        NES_TRACE1("[NES_ROM] Mapped " << path << " - 0x" << std::hex << rom->size() << " bytes");
+        return rom;
+    }
+
+    // Can't map it (not a regular file, or no mmap) - read into heap instead
+    ifstream file(path, std::ifstream::in | std::ifstream::binary);
+    if (!file)
+        throw runtime_error(string("Failed to open ROM file ") + path);
+
+    rom = shared_ptr<nes_rom>(new nes_rom());
+    rom->_heap.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (file.bad())
+        throw runtime_error(string("Failed to read ROM file ") + path);
+
+    rom->_data = rom->_heap.data();
+    rom->_size = rom->_heap.size();
+
+    NES_TRACE1("[NES_ROM] Loaded " << path << " - 0x" << std::hex << rom->size() << " bytes");
+    return rom;
+}
+
+shared_ptr<nes_rom> nes_rom::copy(const uint8_t *data, size_t size)
+{
+    auto rom = shared_ptr<nes_rom>(new nes_rom());
+    rom->_heap.assign(data, data + size);
+    rom->_data = rom->_heap.data();
+    rom->_size = rom->_heap.size();
+
+    return rom;
+}
+
+nes_rom::~nes_rom()
+{
+#if NES_ROM_MMAP
+    if (_mapped)
+        munmap((void *)_data, _size);
+#endif
+}
@@ -4,6 +4,8 @@
 #include "nes_input.h"
 
 #include <algorithm>
+#include <stdexcept>
+#include <string>
 
 using namespace std;
 
@@ -43,9 +45,20 @@ void nes_system::run_program(uint8_t *program_data, std::size_t program_size, ui
 
 void nes_system::load_rom(uint8_t *rom_data, std::size_t rom_size, nes_rom_exec_mode mode)
 {
-    load_mapper(rom_data, rom_size);
-    _ram.load_mapper(_mapper);
-    _ppu.load_mapper(_mapper);
+    // Keep our own copy as banks are mapped in place rather than copied
+    load_rom(nes_rom::copy(rom_data, rom_size), mode);
+}
+
+void nes_system::load_rom(const char *rom_path, nes_rom_exec_mode mode)
+{
+    load_rom(nes_rom::open(rom_path), mode);
+}
+
+void nes_system::load_rom(shared_ptr<nes_rom> rom, nes_rom_exec_mode mode)
+{
+    // Previous mapper still points into the previous ROM if this one doesn't load
+    load_mapper(rom->data(), rom->size());
+    _rom = rom;
 
     if (mode == nes_rom_exec_mode_direct)
     {
@@ -67,7 +80,16 @@ void nes_system::load_rom(uint8_t *rom_data, std::size_t rom_size, nes_rom_exec_
 #define FLAG_6_LO_MAPPER_NUMBER_MASK 0xf0
 #define FLAG_7_HI_MAPPER_NUMBER_MASK 0xf0
 
-void nes_system::load_mapper(uint8_t *rom_data, std::size_t rom_size)
+const nes_system::nes_mapper_registration nes_system::s_mapper_registry[] = {
+    { 0, "NROM",    &nes_system::create_mapper<nes_mapper_nrom>     },
+    { 1, "MMC1",    &nes_system::create_mapper<nes_mapper_mmc1>     },
+    { 2, "UxROM",   &nes_system::create_mapper<nes_mapper_uxrom>    },
+    { 3, "CNROM",   &nes_system::create_mapper<nes_mapper_cnrom>    },
+    { 4, "MMC3",    &nes_system::create_mapper<nes_mapper_mmc3>     },
+    { 7, "AxROM",   &nes_system::create_mapper<nes_mapper_axrom>    },
+};
+
+void nes_system::load_mapper(const uint8_t *rom_data, std::size_t rom_size)
 {
     struct ines_header
     {
@@ -84,17 +106,22 @@ void nes_system::load_mapper(uint8_t *rom_data, std::size_t rom_size)
 
     assert(sizeof(ines_header) == 0x10);
 
-    uint8_t *data = rom_data;
+    const uint8_t *data = rom_data;
 
     // Parse header
+    if (rom_size < sizeof(ines_header))
+        throw runtime_error("Bad ROM - " + to_string(rom_size) + " bytes is too small for iNES header");
+
     ines_header header;
     std::copy_n(data, sizeof(header), (char *)&header);
     data += sizeof(header);
 
+    std::size_t trainer_size = 0;
     if (header.flag6 & FLAG_6_HAS_TRAINER_MASK)
     {
         // skip the 512-byte trainer
-        data += 0x200;
+        trainer_size = 0x200;
+        data += trainer_size;
     }
 
     NES_TRACE1("[NES_ROM] HEADER: Flags6 = 0x" << std::hex << (uint32_t) header.flag6);
@@ -125,22 +152,32 @@ void nes_system::load_mapper(uint8_t *rom_data, std::size_t rom_size)
     NES_TRACE1("[NES_ROM] HEADER: PRG ROM Size = 0x" << std::hex << (uint32_t) prg_rom_size);
     NES_TRACE1("[NES_ROM] HEADER: CHR_ROM Size = 0x" << std::hex << (uint32_t) chr_rom_size);
 
+    std::size_t expected_size = sizeof(header) + trainer_size + prg_rom_size + chr_rom_size;
+    if (expected_size > rom_size)
+    {
+        throw runtime_error("Bad ROM - header needs " + to_string(expected_size) + " bytes but there are only " +
+                            to_string(rom_size));
+    }
+
     auto prg_rom = data;
     data += prg_rom_size;
     auto chr_rom = data;
     data += chr_rom_size;
 
-    // @TODO - Change this into a mapper factory class
-    switch (mapper_id)
+    for (auto &mapper : s_mapper_registry)
     {
-    case 0: _mapper = new(&_mappers._nrom) nes_mapper_nrom(prg_rom, prg_rom_size, chr_rom, chr_rom_size, vertical_mirroring); break;
-    case 1: _mapper = new(&_mappers._mmc1) nes_mapper_mmc1(prg_rom, prg_rom_size, chr_rom, chr_rom_size, vertical_mirroring); break;
-    case 4: _mapper = new(&_mappers._mmc3) nes_mapper_mmc3(prg_rom, prg_rom_size, chr_rom, chr_rom_size, vertical_mirroring); break;
-    default:
-        assert(!"Unsupported mapper id");
+        if (mapper.id == mapper_id)
+        {
+            NES_TRACE1("[NES_ROM] Mapper = " << mapper.name);
+            (this->*mapper.create)(prg_rom, prg_rom_size, chr_rom, chr_rom_size, vertical_mirroring);
+            return;
+        }
     }
+
+    throw runtime_error("Unsupported mapper " + to_string(mapper_id));
 }
 
+
 void nes_system::run_rom(uint8_t *rom_data, std::size_t rom_size, nes_rom_exec_mode mode)
 {
     load_rom(rom_data, rom_size, mode);
@@ -148,9 +185,16 @@ void nes_system::run_rom(uint8_t *rom_data, std::size_t rom_size, nes_rom_exec_m
     test_loop();
 }
 
+void nes_system::run_rom(const char *rom_path, nes_rom_exec_mode mode)
+{
+    load_rom(rom_path, mode);
+
+    test_loop();
+}
+
 void nes_system::test_loop()
 {
-    auto tick = nes_cycle_t(1);
+    auto tick = PPU_SCANLINE_CYCLE;
     while (!_stop_requested)
     {
         step(tick);
@@ -164,6 +208,20 @@ void nes_system::step(nes_cycle_t count)
     // Manually step the individual components instead of all components
     // This saves a loop and also it's kinda stupid to step components that doesn't require stepping in the
     // first place. Such as ram / controller, etc.
-    _cpu.step_to(_master_cycle);
-    _ppu.step_to(_master_cycle);
+    // CPU only stops at the PPU events that CPU could observe without touching PPU registers - all other
+    // synchronization happens in sync_ppu
+    // CPU can also stop early if an event turns up while it is running - see reschedule
+    while (!_stop_requested && _cpu.cycle() < _master_cycle)
+    {
+        nes_cycle_t next_event = _ppu.next_event_cycle();
+        if (next_event >= _master_cycle)
+        {
+            // No need to step PPU to _master_cycle - nothing can observe it before the next sync point
+            _cpu.step_to(_master_cycle);
+            continue;
+        }
+
+        _cpu.step_to(next_event);
+        _ppu.step_to(min(next_event, _cpu.cycle()));
+    }
 }
@@ -13,6 +13,33 @@ void run_program(nes_system *system, std::vector<uint8_t> &&program, uint16_t ad
     system->run_program(program.data(), program.size(), addr);
 }
 
+// What a program run at $0200 until BRK ends up with - see the idle_loop test
+struct idle_loop_result {
+    int64_t cycle;
+    uint32_t side_effect_count;
+    uint32_t status_read_count;
+    uint8_t counter;                // $10
+};
+
+idle_loop_result run_idle_loop(std::vector<uint8_t> &&program, bool skip) {
+    nes_system system;
+    system.power_on();
+
+    // Profiling needs every instruction so it turns idle loop skipping off
+    system.cpu()->enable_profiler(!skip);
+
+    // NMI handler at $0300 stops
+    uint8_t nmi_handler[] = { 0x00 };
+    uint8_t nmi_vector[] = { 0x00, 0x03 };
+    system.ram()->set_bytes(0x0300, nmi_handler, sizeof(nmi_handler));
+    system.ram()->set_bytes(0xfffa, nmi_vector, sizeof(nmi_vector));
+
+    run_program(&system, std::move(program), 0x0200);
+
+    auto ram = system.ram();
+    return { system.cpu()->cycle().count(), ram->side_effect_count(), ram->status_read_count(), ram->get_byte(0x10) };
+}
+
 TEST_CASE("CPU tests") {
     nes_system system;
 
@@ -69,6 +96,156 @@ TEST_CASE("CPU tests") {
         CHECK(cpu->A() == 1);
         CHECK((cpu->P() & PROCESSOR_STATUS_CARRY_MASK));
     }
+    SUBCASE("profiler") {
+        INIT_TRACE("neschan.instrtest.profiler.log");
+
+        cout << "Running [CPU][profiler]..." << endl;
+
+        system.power_on();
+
+        auto cpu = system.cpu();
+        cpu->enable_profiler(true);
+
+        run_program(&system,
+            {
+                0xa2, 0x03,     // LDX #$3
+                0xca,           // DEX          -> loop 3 times
+                0xd0, 0xfd,     // BNE $1002
+                0x00,           // BRK
+            },
+            0x1000);
+
+        auto profile = cpu->profile();
+
+        CHECK(profile->op_codes[0xa2].count == 1);
+        CHECK(profile->op_codes[0xca].count == 3);
+        CHECK(profile->op_codes[0xca].cycles == 6);
+        CHECK(profile->pcs[0x1003].count == 3);
+        CHECK(profile->pcs[0x1003].cycles == 3 + 3 + 2);
+
+        cpu->enable_profiler(false);
+        CHECK(cpu->profile() == nullptr);
+    }
+    SUBCASE("decode_cache") {
+        INIT_TRACE("neschan.instrtest.decode_cache.log");
+
+        cout << "Running [CPU][decode_cache]..." << endl;
+
+        system.power_on();
+
+        // UxROM with INY / RTS at $8000 of bank 0 and INX / RTS at $8000 of bank 1
+        auto rom = make_rom(2, 2, 0);
+        rom[0x10] = 0xc8;
+        rom[0x11] = 0x60;
+        rom[0x10 + 0x4000] = 0xe8;
+        rom[0x10 + 0x4001] = 0x60;
+        system.load_rom(rom.data(), rom.size(), nes_rom_exec_mode_reset);
+
+        run_program(&system,
+            {
+                0x20, 0x00, 0x80,   // JSR $8000    -> bank 0: Y = 1
+                0xa9, 0x01,         // LDA #$1
+                0x8d, 0x00, 0x80,   // STA $8000    -> switch to bank 1
+                0x20, 0x00, 0x80,   // JSR $8000    -> bank 1: X = 1
+                0xa9, 0x00,         // LDA #$0
+                0x8d, 0x00, 0x80,   // STA $8000    -> switch back to bank 0
+                0x20, 0x00, 0x80,   // JSR $8000    -> bank 0: Y = 2
+                0x00,               // BRK
+            },
+            0x0200);
+
+        auto cpu = system.cpu();
+
+        CHECK(cpu->X() == 1);
+        CHECK(cpu->Y() == 2);
+
+        // No mapper - $8000~$ffff is RAM and code can rewrite itself
+        system.power_on();
+
+        run_program(&system,
+            {
+                0x20, 0x10, 0x80,   // JSR $8010    -> Y = 1
+                0xa9, 0xe8,         // LDA #$e8
+                0x8d, 0x10, 0x80,   // STA $8010    -> INY becomes INX
+                0x20, 0x10, 0x80,   // JSR $8010    -> X = 1
+                0x00,               // BRK
+                0x00, 0x00, 0x00, 0x00,
+                0xc8,               // INY
+                0x60,               // RTS
+            },
+            0x8000);
+
+        CHECK(cpu->X() == 1);
+        CHECK(cpu->Y() == 1);
+    }
+    SUBCASE("idle_loop") {
+        INIT_TRACE("neschan.instrtest.idle_loop.log");
+
+        cout << "Running [CPU][idle_loop]..." << endl;
+
+        // Waiting for VBlank - the skipped iterations don't read PPUSTATUS but end on the same cycle
+        auto vblank_wait = [] {
+            return std::vector<uint8_t> {
+                0xad, 0x02, 0x20,   // LDA $2002
+                0x10, 0xfb,         // BPL $0200
+                0xad, 0x02, 0x20,   // LDA $2002
+                0x10, 0xfb,         // BPL $0205
+                0x00,               // BRK
+            };
+        };
+        auto skipped = run_idle_loop(vblank_wait(), true);
+        auto stepped = run_idle_loop(vblank_wait(), false);
+        CHECK(skipped.cycle == stepped.cycle);
+        CHECK(skipped.status_read_count < stepped.status_read_count);
+
+        // Waiting for NMI - PPU needs to warm up before taking PPUCTRL so wait for 2 VBlanks first
+        auto nmi_wait = [] {
+            return std::vector<uint8_t> {
+                0xad, 0x02, 0x20,   // LDA $2002
+                0x10, 0xfb,         // BPL $0200
+                0xad, 0x02, 0x20,   // LDA $2002
+                0x10, 0xfb,         // BPL $0205
+                0xa9, 0x80,         // LDA #$80
+                0x8d, 0x00, 0x20,   // STA $2000    -> NMI on
+                0x4c, 0x0f, 0x02,   // JMP $020f    -> until NMI handler BRKs
+            };
+        };
+        skipped = run_idle_loop(nmi_wait(), true);
+        stepped = run_idle_loop(nmi_wait(), false);
+        CHECK(skipped.cycle == stepped.cycle);
+        CHECK(skipped.status_read_count < stepped.status_read_count);
+
+        // Loops writing memory are never skipped
+        auto write_loop = [] {
+            return std::vector<uint8_t> {
+                0xe6, 0x10,         // INC $10
+                0xad, 0x02, 0x20,   // LDA $2002
+                0x10, 0xf9,         // BPL $0200
+                0x00,               // BRK
+            };
+        };
+        skipped = run_idle_loop(write_loop(), true);
+        stepped = run_idle_loop(write_loop(), false);
+        CHECK(skipped.cycle == stepped.cycle);
+        CHECK(skipped.counter == stepped.counter);
+        CHECK(skipped.side_effect_count == stepped.side_effect_count);
+        CHECK(skipped.status_read_count == stepped.status_read_count);
+
+        // Neither are loops reading IO registers other than PPUSTATUS
+        auto input_loop = [] {
+            return std::vector<uint8_t> {
+                0xad, 0x16, 0x40,   // LDA $4016
+                0xad, 0x02, 0x20,   // LDA $2002
+                0x10, 0xf8,         // BPL $0200
+                0x00,               // BRK
+            };
+        };
+        skipped = run_idle_loop(input_loop(), true);
+        stepped = run_idle_loop(input_loop(), false);
+        CHECK(skipped.cycle == stepped.cycle);
+        CHECK(skipped.side_effect_count == stepped.side_effect_count);
+        CHECK(skipped.status_read_count == stepped.status_read_count);
+    }
     SUBCASE("nestest") {
         INIT_TRACE("neschan.instrtest.full.log");
         cout << "Running [CPU][nestest]..." << endl;
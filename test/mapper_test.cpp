@@ -0,0 +1,315 @@
+#include "stdafx.h"
+
+#include "doctest.h"
+#include "nes_trace.h"
+#include "nes_mapper.h"
+#include "nes_system.h"
+
+#include "rom_runner.h"
+
+using namespace std;
+
+// MMC3 ROM that renders with the given PPUCTRL and enables IRQ every latch + 1 scanlines - with IRQ masked
+// for the first 2 frames after that, and for good if cli is false. IRQ handler counts in $10
+std::vector<uint8_t> make_mmc3_irq_rom(uint8_t ppu_ctrl, uint8_t latch, bool cli) {
+    auto rom = make_rom(4, 2, 1);
+    uint8_t code[] = {
+        0x78,               // E000: SEI
+        0x2c, 0x02, 0x20,   // E001: BIT $2002
+        0x10, 0xfb,         //       BPL $E001
+        0x2c, 0x02, 0x20,   // E006: BIT $2002  -> PPU is warmed up after 2 VBlanks
+        0x10, 0xfb,         //       BPL $E006
+        0xa9, ppu_ctrl,     //       LDA #ppu_ctrl
+        0x8d, 0x00, 0x20,   //       STA $2000
+        0xa9, 0x18,         //       LDA #$18
+        0x8d, 0x01, 0x20,   //       STA $2001  -> show background and sprites
+        0xa9, latch,        //       LDA #latch
+        0x8d, 0x00, 0xc0,   //       STA $C000  -> IRQ latch
+        0x8d, 0x01, 0xc0,   //       STA $C001  -> IRQ reload
+        0x8d, 0x01, 0xe0,   //       STA $E001  -> IRQ enable
+        0x2c, 0x02, 0x20,   // E020: BIT $2002
+        0x10, 0xfb,         //       BPL $E020
+        0x2c, 0x02, 0x20,   // E025: BIT $2002
+        0x10, 0xfb,         //       BPL $E025
+        0xa5, 0x10,         //       LDA $10
+        0x85, 0x11,         //       STA $11    -> IRQs taken while masked
+        uint8_t(cli ? 0x58 : 0xea), //  CLI / NOP
+        0x4c, 0x2f, 0xe0,   // E02F: JMP $E02F
+        0x8d, 0x00, 0xe0,   // E032: STA $E000  -> acknowledge
+        0x8d, 0x01, 0xe0,   //       STA $E001
+        0xe6, 0x10,         //       INC $10
+        0x40,               // E03A: RTI
+    };
+
+    // Last 8KB bank is always at $E000
+    uint8_t *prg_rom = rom.data() + 0x10;
+    memcpy(prg_rom + 0x6000, code, sizeof(code));
+    uint8_t vectors[] = { 0x3a, 0xe0, 0x00, 0xe0, 0x32, 0xe0 };
+    memcpy(prg_rom + 0x7ffa, vectors, sizeof(vectors));
+
+    return rom;
+}
+
+// iNES image where each 8KB PRG bank starts with its bank number, and so does each 1KB CHR bank
+std::vector<uint8_t> make_banked_rom(uint8_t mapper_id, uint8_t prg_rom_size, uint8_t chr_rom_size) {
+    auto rom = make_rom(mapper_id, prg_rom_size, chr_rom_size);
+    uint8_t *prg_rom = rom.data() + 0x10;
+    for (int bank = 0; bank < prg_rom_size * 2; ++bank)
+        prg_rom[bank * 0x2000] = uint8_t(bank);
+
+    uint8_t *chr_rom = prg_rom + prg_rom_size * 0x4000;
+    for (int bank = 0; bank < chr_rom_size * 8; ++bank)
+        chr_rom[bank * 0x400] = uint8_t(bank);
+
+    return rom;
+}
+
+TEST_CASE("mapper_tests") {
+    nes_system system;
+
+    SUBCASE("rom_sharing") {
+        INIT_TRACE("neschan.mapper.rom_sharing.log");
+        cout << "Running [MAPPER][rom_sharing]..." << endl;
+
+        // Opening the file again shares the mapping that is still in use
+        auto rom_1 = nes_rom::open("./roms/nestest/nestest.nes");
+        auto rom_2 = nes_rom::open("./roms/nestest/nestest.nes");
+        CHECK(rom_1->size() == rom_2->size());
+        if (rom_1->is_mapped())
+        {
+            CHECK(rom_1 == rom_2);
+            CHECK(rom_1->data() == rom_2->data());
+        }
+    }
+    SUBCASE("rom_validation") {
+        INIT_TRACE("neschan.mapper.rom_validation.log");
+        cout << "Running [MAPPER][rom_validation]..." << endl;
+
+        system.power_on();
+
+        auto rom = make_rom(0, 2, 1);
+        CHECK_THROWS_AS(system.load_rom(rom.data(), 8, nes_rom_exec_mode_reset), runtime_error);
+        CHECK_THROWS_AS(system.load_rom(rom.data(), rom.size() - 1, nes_rom_exec_mode_reset), runtime_error);
+        CHECK_NOTHROW(system.load_rom(rom.data(), rom.size(), nes_rom_exec_mode_reset));
+
+        // Trainer takes another 512 bytes
+        rom[6] |= 0x4;
+        CHECK_THROWS_AS(system.load_rom(rom.data(), rom.size(), nes_rom_exec_mode_reset), runtime_error);
+        rom.resize(rom.size() + 0x200);
+        CHECK_NOTHROW(system.load_rom(rom.data(), rom.size(), nes_rom_exec_mode_reset));
+    }
+    SUBCASE("uxrom") {
+        INIT_TRACE("neschan.mapper.uxrom.log");
+        cout << "Running [MAPPER][uxrom]..." << endl;
+
+        system.power_on();
+
+        auto rom = make_banked_rom(2, 8, 0);
+        system.load_rom(rom.data(), rom.size(), nes_rom_exec_mode_reset);
+        auto ram = system.ram();
+
+        // 16KB bank 0 at $8000, last one at $C000
+        CHECK(ram->get_byte(0x8000) == 0);
+        CHECK(ram->get_byte(0xa000) == 1);
+        CHECK(ram->get_byte(0xc000) == 14);
+        CHECK(ram->get_byte(0xe000) == 15);
+
+        // Only $8000 switches
+        ram->set_byte(0x8000, 5);
+        CHECK(ram->get_byte(0x8000) == 10);
+        CHECK(ram->get_byte(0xa000) == 11);
+        CHECK(ram->get_byte(0xc000) == 14);
+
+        // Bank 9 of 8 wraps to bank 1
+        ram->set_byte(0xffff, 9);
+        CHECK(ram->get_byte(0x8000) == 2);
+        CHECK(ram->get_byte(0xc000) == 14);
+    }
+    SUBCASE("cnrom") {
+        INIT_TRACE("neschan.mapper.cnrom.log");
+        cout << "Running [MAPPER][cnrom]..." << endl;
+
+        system.power_on();
+
+        auto rom = make_banked_rom(3, 2, 4);
+        system.load_rom(rom.data(), rom.size(), nes_rom_exec_mode_reset);
+        auto ram = system.ram();
+        auto ppu = system.ppu();
+
+        CHECK(ppu->read_byte(0x0000) == 0);
+        CHECK(ram->get_byte(0xc000) == 2);
+
+        // 8KB CHR bank 2 - PRG doesn't move
+        ram->set_byte(0x8000, 2);
+        CHECK(ppu->read_byte(0x0000) == 16);
+        CHECK(ppu->read_byte(0x1c00) == 23);
+        CHECK(ram->get_byte(0x8000) == 0);
+
+        // Bank 7 of 4 wraps to bank 3
+        ram->set_byte(0x8000, 7);
+        CHECK(ppu->read_byte(0x0000) == 24);
+    }
+    SUBCASE("axrom") {
+        INIT_TRACE("neschan.mapper.axrom.log");
+        cout << "Running [MAPPER][axrom]..." << endl;
+
+        system.power_on();
+
+        auto rom = make_banked_rom(7, 16, 0);
+        system.load_rom(rom.data(), rom.size(), nes_rom_exec_mode_reset);
+        auto ram = system.ram();
+        auto ppu = system.ppu();
+
+        // 32KB bank 3 - one screen lower name table
+        ram->set_byte(0x8000, 0x03);
+        CHECK(ram->get_byte(0x8000) == 12);
+        CHECK(ram->get_byte(0xe000) == 15);
+        ppu->write_byte(0x2000, 0x11);
+        CHECK(ppu->read_byte(0x2400) == 0x11);
+        CHECK(ppu->read_byte(0x2800) == 0x11);
+        CHECK(ppu->read_byte(0x2c00) == 0x11);
+
+        // Bit 4 - one screen upper name table
+        ram->set_byte(0x8000, 0x13);
+        CHECK(ram->get_byte(0x8000) == 12);
+        CHECK(ppu->read_byte(0x2000) != 0x11);
+        ppu->write_byte(0x2c00, 0x22);
+        CHECK(ppu->read_byte(0x2000) == 0x22);
+
+        ram->set_byte(0x8000, 0x03);
+        CHECK(ppu->read_byte(0x2400) == 0x11);
+
+        // Bank 11 of 8 wraps to bank 3
+        ram->set_byte(0x8000, 0x0b);
+        CHECK(ram->get_byte(0x8000) == 12);
+    }
+    SUBCASE("unknown_mapper") {
+        INIT_TRACE("neschan.mapper.unknown_mapper.log");
+        cout << "Running [MAPPER][unknown_mapper]..." << endl;
+
+        system.power_on();
+
+        // MMC5 isn't supported
+        auto rom = make_rom(5, 2, 1);
+        CHECK_THROWS_AS(system.load_rom(rom.data(), rom.size(), nes_rom_exec_mode_reset), runtime_error);
+    }
+    SUBCASE("mmc3_irq_counter") {
+        INIT_TRACE("neschan.mapper.mmc3_irq_counter.log");
+        cout << "Running [MAPPER][mmc3_irq_counter]..." << endl;
+
+        system.power_on();
+
+        std::vector<uint8_t> prg_rom(0x8000), chr_rom(0x2000);
+        nes_mapper_mmc3 mapper(prg_rom.data(), prg_rom.size(), chr_rom.data(), chr_rom.size(), false);
+        mapper.on_load_cpu(*system.cpu());
+        auto cpu = system.cpu();
+
+        // Disabled - never raises IRQ
+        CHECK(mapper.a12_rises_until_irq() == -1);
+
+        // Latch 3 - first rise reloads, then 3 decrements to 0
+        mapper.write_reg(0xc000, 3);
+        mapper.write_reg(0xc001, 0);
+        mapper.write_reg(0xe001, 0);
+        CHECK(mapper.a12_rises_until_irq() == 4);
+        for (int rise = 0; rise < 3; ++rise)
+        {
+            mapper.on_a12_rise();
+            CHECK(!cpu->irq_line());
+        }
+        CHECK(mapper.a12_rises_until_irq() == 1);
+        mapper.on_a12_rise();
+        CHECK(cpu->irq_line());
+
+        // $E000 acknowledges and disables
+        mapper.write_reg(0xe000, 0);
+        CHECK(!cpu->irq_line());
+        CHECK(mapper.a12_rises_until_irq() == -1);
+        for (int rise = 0; rise < 8; ++rise)
+            mapper.on_a12_rise();
+        CHECK(!cpu->irq_line());
+
+        // $C001 in the middle of counting starts over from latch at the next rise
+        mapper.write_reg(0xe001, 0);
+        mapper.write_reg(0xc001, 0);
+        mapper.on_a12_rise();
+        mapper.on_a12_rise();
+        CHECK(mapper.a12_rises_until_irq() == 2);
+        mapper.write_reg(0xc001, 0);
+        CHECK(mapper.a12_rises_until_irq() == 4);
+        mapper.on_a12_rise();
+        CHECK(mapper.a12_rises_until_irq() == 3);
+
+        // Latch 0 - IRQ on every rise once reloaded
+        mapper.write_reg(0xc000, 0);
+        mapper.write_reg(0xc001, 0);
+        CHECK(mapper.a12_rises_until_irq() == 1);
+        for (int rise = 0; rise < 3; ++rise)
+        {
+            mapper.on_a12_rise();
+            CHECK(cpu->irq_line());
+            mapper.write_reg(0xe000, 0);
+            mapper.write_reg(0xe001, 0);
+            CHECK(mapper.a12_rises_until_irq() == 1);
+        }
+    }
+    SUBCASE("mmc3_irq_timing") {
+        INIT_TRACE("neschan.mapper.mmc3_irq_timing.log");
+        cout << "Running [MAPPER][mmc3_irq_timing]..." << endl;
+
+        // Sprites at $1000 rise at dot 260, background at $1000 at dot 324
+        for (uint8_t ppu_ctrl : { 0x08, 0x10 })
+        {
+            for (uint8_t latch : { 0, 5, 100 })
+            {
+                system.power_on();
+
+                auto rom = make_mmc3_irq_rom(ppu_ctrl, latch, /* cli = */ false);
+                system.load_rom(rom.data(), rom.size(), nes_rom_exec_mode_reset);
+
+                auto cpu = system.cpu();
+                auto ppu = system.ppu();
+                while (cpu->PC() != 0xe02f)
+                    system.step(PPU_SCANLINE_CYCLE);
+
+                // Step PPU alone one dot at a time (CPU stays put) - the line rises when the PPU dot loop
+                // gets to the A12 rise, which needs to be exactly where cycles_until_irq predicts
+                system.sync_ppu();
+                nes_cycle_t cycle = cpu->cycle();
+                for (int irq = 0; irq < 3; ++irq)
+                {
+                    system.ram()->set_byte(0xe000, 0);
+                    system.ram()->set_byte(0xe001, 0);
+                    CHECK(!cpu->irq_line());
+
+                    int64_t predicted = ppu->cycles_until_irq();
+                    int64_t until_irq = 0;
+                    while (!cpu->irq_line() && until_irq < 2 * PPU_FRAME_CYCLE)
+                    {
+                        cycle += nes_cycle_t(1);
+                        ppu->step_to(cycle);
+                        until_irq++;
+                    }
+
+                    CHECK(until_irq == predicted);
+                }
+            }
+        }
+    }
+    SUBCASE("mmc3_irq_mask") {
+        INIT_TRACE("neschan.mapper.mmc3_irq_mask.log");
+        cout << "Running [MAPPER][mmc3_irq_mask]..." << endl;
+
+        system.power_on();
+
+        auto rom = make_mmc3_irq_rom(0x08, 10, /* cli = */ true);
+        system.ppu()->stop_after_frame(10);
+        system.run_rom(rom.data(), rom.size(), nes_rom_exec_mode_reset);
+
+        auto cpu = system.cpu();
+
+        // Nothing is taken while I is set - then the pending one and all following ones are
+        CHECK(cpu->peek(0x11) == 0);
+        CHECK(cpu->peek(0x10) > 0);
+    }
+}
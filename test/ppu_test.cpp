@@ -33,6 +33,33 @@ TEST_CASE("ppu_tests") {
         CHECK(ppu->read_byte(0x3f02) == 0x2d);
         CHECK(ppu->read_byte(0x3f03) == 0x30);
         CHECK(ppu->read_byte(0x3f13) == 0x30);
+
+        // Latest completed frame can be taken only once
+        CHECK(ppu->acquire_frame());
+        CHECK(ppu->frame_sequence() == 11);
+        CHECK(!ppu->acquire_frame());
+        CHECK(ppu->frame_sequence() == 11);
+    }
+    SUBCASE("color_test_frame_skip") {
+        INIT_TRACE("neschan.ppu.colortest.skip.log");
+        cout << "Running [PPU][color_test_frame_skip]..." << endl;
+
+        system.power_on();
+
+        // Only the frame already in progress is rendered
+        system.ppu()->set_render(false);
+        system.ppu()->stop_after_frame(10);
+
+        run_rom(&system, "./roms/color_test/color_test.nes", nes_rom_exec_mode_reset);
+
+        auto cpu = system.cpu();
+        auto ppu = system.ppu();
+
+        // Game runs the same - just nothing gets published after the first frame
+        CHECK(cpu->PC() == 0x8153);
+        CHECK(ppu->read_byte(0x3f01) == 0x16);
+        CHECK(ppu->acquire_frame());
+        CHECK(ppu->frame_sequence() == 1);
     }
     SUBCASE("vbl_clear_time") {
         INIT_TRACE("neschan.ppu.vbl_clear_time.log");
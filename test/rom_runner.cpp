@@ -1,18 +1,18 @@
 #include "rom_runner.h"
 
 void run_rom(nes_system *system, const char *path, nes_rom_exec_mode mode) {
-    ifstream file;
-    file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    file.open(path, std::ifstream::in | std::ifstream::binary);
-
-    std::vector<uint8_t> rom_data;
-
-    file.seekg(0, std::ios::end);
-    rom_data.reserve(file.tellg());
-    file.seekg(0, std::ios::beg);
-
-    rom_data.assign((std::istreambuf_iterator<char>(file)),
-                     std::istreambuf_iterator<char>());
+    system->run_rom(path, mode);
+}
 
-    system->run_rom(rom_data.data(), rom_data.size(), mode);
+std::vector<uint8_t> make_rom(uint8_t mapper_id, uint8_t prg_rom_size, uint8_t chr_rom_size) {
+    std::vector<uint8_t> rom(0x10 + prg_rom_size * 0x4000 + chr_rom_size * 0x2000);
+    rom[0] = 'N';
+    rom[1] = 'E';
+    rom[2] = 'S';
+    rom[3] = 0x1a;
+    rom[4] = prg_rom_size;
+    rom[5] = chr_rom_size;
+    rom[6] = uint8_t(mapper_id << 4);
+    rom[7] = uint8_t(mapper_id & 0xf0);
+    return rom;
 }
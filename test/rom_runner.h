@@ -7,3 +7,6 @@
 #include <streambuf>
 
 void run_rom(nes_system *system, const char *path, nes_rom_exec_mode mode);
+
+// iNES image with prg_rom_size x 16KB PRG ROM and chr_rom_size x 8KB CHR ROM, all zero - fill in as needed
+std::vector<uint8_t> make_rom(uint8_t mapper_id, uint8_t prg_rom_size, uint8_t chr_rom_size);